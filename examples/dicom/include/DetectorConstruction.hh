@@ -31,10 +31,12 @@
 #define DetectorConstruction_H 1
 
 #include <vector>
+#include <future>
 #include <inttypes.h>
 
 
 #include "G4VoxelData.hh"
+#include "DicomDataIO.hh"
 
 // GEANT4 //
 #include "G4VUserDetectorConstruction.hh"
@@ -88,6 +90,10 @@ class DetectorConstruction : public G4VUserDetectorConstruction
 
     // Directory of DICOM CT to load
     G4String dir;
+
+    // Pending read of `dir`, started in the constructor
+    DicomDataIO* reader;
+    std::shared_future<G4VoxelData*> data;
 };
 #endif
 
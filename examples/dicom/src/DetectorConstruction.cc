@@ -27,6 +27,7 @@
 
 
 #include <iostream>
+#include <exception>
 
 // USER //
 #include "DetectorConstruction.hh"
@@ -61,6 +62,18 @@ DetectorConstruction::DetectorConstruction(G4String dir)
     hounsfield.push_back(Hounsfield(2500,"G4_BONE_CORTICAL_ICRP", 2.088));
 
     this->dir = dir;
+
+    // Start loading the CT now, the run manager builds the physics list
+    // while the slices are read and we only wait for them in Construct.
+    reader = new DicomDataIO();
+    reader->SetVerbose(true);
+    // read and sort in z/slice direction: true
+    // reader->SetSort(true);
+    // reader->SetModality("CT");
+    // reader->SetAcquisitionNumber(1);
+    // reader->SetSlope(10);
+    // reader->SetIntercept(0); 
+    data = reader->ReadDirectoryAsync(dir);
 }
 
 
@@ -79,20 +92,24 @@ G4VPhysicalVolume* DetectorConstruction::Construct()
     world_physical = new G4PVPlacement(0, G4ThreeVector(), world_logical, "world_physical", 0, false, 0);
     world_logical->SetVisAttributes(G4VisAttributes::Invisible);
     
-    DicomDataIO* reader = new DicomDataIO();
-    reader->SetVerbose(true);
-    // read and sort in z/slice direction: true
-    // reader->SetSort(true);
-    // reader->SetModality("CT");
-    // reader->SetAcquisitionNumber(1);
-    // reader->SetSlope(10);
-    // reader->SetIntercept(0); 
-    G4VoxelData* data = reader->ReadDirectory(dir);
+    // Wait for the read started in the constructor. It hands back NULL,
+    // or rethrows here, if the directory could not be read.
+    G4VoxelData* voxel_data = NULL;
+    try {
+        voxel_data = data.get();
+    } catch (std::exception& e) {
+        G4cerr << "Reading " << dir << " failed: " << e.what() << G4endl;
+    }
+
+    if (voxel_data == NULL) {
+        G4Exception("DetectorConstruction::Construct", "ReadFailed",
+                FatalException, ("Cannot read DICOM images from " + dir).c_str());
+    }
 
-    // We can peek at the data type with data->type, however at some point
-    // we will have to nominate exactly what the type of the data is. For
+    // We can peek at the data type with voxel_data->type, however at some
+    // point we will have to nominate exactly what the type of the data is. For
     // standard DICOM CT as in this example we are using int16's.
-    G4VoxelArray<int16_t>* array = new G4VoxelArray<int16_t>(data);
+    G4VoxelArray<int16_t>* array = new G4VoxelArray<int16_t>(voxel_data);
     
     // We can crop away unwanted parts of the dataset by setting
     // array->Crop(xmin, xmax, ymin, ymax, zmin, zmax);
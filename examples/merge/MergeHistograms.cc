@@ -0,0 +1,111 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+
+// Merge the histograms of many jobs, see G4VoxelHistogramMerger.
+//
+//     MergeHistograms [-t threads] [-s slab thickness] [-m mass] [-v]
+//                     output job [job ...]
+//
+// A job is an npz or HDF5 file or a prefix of .npy files, optionally
+// followed by "=weight". Jobs may also be listed in a file, one per line
+// as "job [weight]", given as "@list.txt". Writes "<output>_sum.npy" etc.
+
+#include "G4VoxelHistogramMerger.hh"
+#include "G4VoxelDataIORegistry.hh"
+#include "NumpyDataIO.hh"
+#include "HDF5DataIO.hh"
+
+// STL //
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+
+void AddJob(G4VoxelHistogramMerger& merger, std::string job)
+{
+    size_t split = job.rfind('=');
+    if (split == std::string::npos) {
+        merger.AddJob(job);
+    } else {
+        merger.AddJob(job.substr(0, split), atof(job.c_str() + split + 1));
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    G4VoxelDataIORegistry* registry = G4VoxelDataIORegistry::GetInstance();
+    registry->Register<NumpyDataIO>("NUMPY");
+    registry->Register<HDF5DataIO>("HDF5");
+
+    G4VoxelHistogramMerger merger;
+    std::string output;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            merger.SetThreads(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            merger.SetSlabThickness(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            merger.SetMass(argv[++i]);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            merger.SetVerbose(true);
+        } else if (output.empty()) {
+            output = argv[i];
+        } else if (argv[i][0] == '@') {
+            std::ifstream list(argv[i] + 1);
+            std::string line;
+            while (std::getline(list, line)) {
+                std::istringstream fields(line);
+                std::string job;
+                G4double weight = 1;
+                if (!(fields >> job) || job[0] == '#') continue;
+                fields >> weight;
+                merger.AddJob(job, weight);
+            }
+        } else {
+            AddJob(merger, argv[i]);
+        }
+    }
+
+    if (output.empty() || merger.GetNumberOfJobs() == 0) {
+        G4cerr << "Usage: MergeHistograms [-t threads] [-s slab thickness] "
+               << "[-m mass] [-v] output job [job ...]" << G4endl;
+        return 1;
+    }
+
+    if (!merger.Merge(output)) return 1;
+
+    G4cout << "Merged " << merger.GetNumberOfJobs() << " jobs, "
+           << merger.GetNumberOfEvents() << " events, into " << output << G4endl;
+
+    return 0;
+}
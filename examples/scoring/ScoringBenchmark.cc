@@ -0,0 +1,319 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+// Throughput of G4VoxelDetector accumulation modes. Each thread scores
+// deposits directly with `Deposit` (no tracking), half of them into a
+// small central block of voxels, as a beam would, to expose contention.
+// The error is the largest relative error of the energy in any voxel,
+// against exact sums of the same deposits (all multiples of 1 keV).
+// Deposits are grouped into events of 100; with snapshots the master
+// writes ten snapshots over the run in the background (with thread-local
+// records, after each worker merges its records into the master).
+//
+// Followed by the cost of finding the scoring voxel of a hit on a single
+// thread: from replica numbers on an aligned grid, through the geometry to
+// scoring voxel tables, from a position on a shifted grid, and splitting
+// steps among the voxels they cross.
+//
+//     ScoringBenchmark [threads] [deposits per thread] [voxels per axis]
+
+#include "G4VoxelDetector.hh"
+#include "G4VoxelScoringGrid.hh"
+
+// STL //
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <stdint.h>
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+struct Options {
+    unsigned int threads;
+    unsigned int deposits;
+    unsigned int size;
+
+    G4bool compensated;
+    G4bool snapshots;
+
+    // Energy per voxel in keV of all threads' deposits
+    std::vector<int64_t> reference;
+};
+
+
+// Small, fast and reproducible per thread
+class Random {
+  public:
+    Random(uint64_t seed) : state(seed*2862933555777941757ULL + 3037000493ULL) {};
+
+    unsigned int Next(unsigned int n) {
+        state = state*6364136223846793005ULL + 1442695040888963407ULL;
+        return (unsigned int) ((state >> 33) % n);
+    };
+
+  private:
+    uint64_t state;
+};
+
+
+// Calls `f(x, y, z, energy)` for the deposits of thread `seed`.
+template <typename F>
+void Generate(unsigned int seed, const Options& options, F f) {
+    Random random(seed);
+
+    unsigned int n = options.size;
+    unsigned int hot = std::max(n/16, 1u);
+
+    for (unsigned int i=0; i<options.deposits; i++) {
+        unsigned int x, y, z;
+        if (i % 2 == 0) {
+            x = n/2 + random.Next(hot) - hot/2;
+            y = n/2 + random.Next(hot) - hot/2;
+            z = n/2 + random.Next(hot) - hot/2;
+        } else {
+            x = random.Next(n);
+            y = random.Next(n);
+            z = random.Next(n);
+        }
+
+        f(x, y, z, 1 + random.Next(1000));
+    }
+}
+
+
+template <typename Detector>
+void Fill(Detector* detector, unsigned int seed, const Options* options) {
+    unsigned int deposits = 0;
+    Generate(seed, *options, [&](unsigned int x, unsigned int y, unsigned int z,
+                                 unsigned int kev) {
+        detector->Deposit(x, y, z, 0.001*kev, 1);
+        if (++deposits % 100 == 0) detector->EndOfEvent(NULL);
+    });
+}
+
+
+void FillReference(Options& options) {
+    size_t n = options.size;
+    options.reference.assign(n*n*n, 0);
+
+    for (unsigned int i=0; i<options.threads; i++) {
+        Generate(i, options, [&](unsigned int x, unsigned int y, unsigned int z,
+                                 unsigned int kev) {
+            options.reference[x + n*(y + n*z)] += kev;
+        });
+    }
+}
+
+
+template <typename T, typename Records=G4VoxelRecordArray<T> >
+void Benchmark(G4String label, Accumulation accumulation, Options options,
+               G4bool compensated=false, G4bool snapshots=false) {
+    options.compensated = compensated;
+    options.snapshots = snapshots;
+
+    typedef G4VoxelDetector<T, Records> Detector;
+
+    std::vector<unsigned int> shape(3, options.size);
+    std::vector<double> spacing(3, 1.);
+
+    Detector* master = new Detector("master", shape, spacing, accumulation);
+    master->SetCompensation(options.compensated);
+
+    G4VoxelSnapshotWriter writer;
+    G4long events = (G4long) options.threads * options.deposits / 100;
+    if (options.snapshots) {
+        master->SetSnapshots(&writer, std::max<G4long>(events / 10, 1), "snapshot");
+    }
+
+    std::vector<Detector*> workers;
+    for (unsigned int i=0; i<options.threads; i++) {
+        workers.push_back(new Detector("worker", master, i));
+    }
+
+    Clock::time_point start = Clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned int i=0; i<options.threads; i++) {
+        threads.push_back(std::thread(Fill<Detector>, workers[i], i, &options));
+    }
+    for (unsigned int i=0; i<threads.size(); i++) {
+        threads[i].join();
+    }
+
+    Clock::time_point filled = Clock::now();
+    double bytes = master->GetRecords()->GetBytes();
+    for (unsigned int i=0; i<workers.size() && accumulation == LOCAL_ACCUMULATION; i++) {
+        bytes += workers[i]->GetRecords()->GetBytes();
+    }
+
+    master->Reduce();
+    Clock::time_point reduced = Clock::now();
+
+    writer.Wait();
+    for (G4long n=1; options.snapshots && n<=events; n++) {
+        std::ostringstream filename;
+        filename << "snapshot_" << n << ".bin";
+        std::remove(filename.str().c_str());
+    }
+
+    double fill = std::chrono::duration<double>(filled - start).count();
+    double reduce = std::chrono::duration<double>(reduced - filled).count();
+    double deposits = (double) options.threads * options.deposits;
+
+    G4VoxelArray<double>* energy = master->GetEnergyValues();
+    double error = 0;
+    for (size_t i=0; i<options.reference.size(); i++) {
+        if (options.reference[i] == 0) continue;
+
+        double exact = 0.001*options.reference[i];
+        error = std::max(error, std::abs((*energy->array)[i] - exact) / exact);
+    }
+    delete energy->GetData();
+    delete energy;
+
+    G4cout << std::left << std::setw(24) << label
+           << std::right << std::setw(10) << std::fixed << std::setprecision(2)
+           << deposits / fill / 1e6 << " Mdeposits/s"
+           << std::setw(10) << reduce*1e3 << " ms reduce"
+           << std::setw(10) << bytes / (1 << 20) << " MiB"
+           << std::setw(12) << std::scientific << std::setprecision(1)
+           << error << " error" << G4endl;
+
+    for (unsigned int i=0; i<workers.size(); i++) {
+        delete workers[i];
+    }
+    delete master;
+}
+
+
+template <typename F>
+void BenchmarkIndexing(G4String label, unsigned int n, F f) {
+    Random random(1);
+    G4long checksum = 0;
+
+    Clock::time_point start = Clock::now();
+    for (unsigned int i=0; i<n; i++) {
+        checksum += f(random);
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    G4cout << std::left << std::setw(24) << label
+           << std::right << std::setw(10) << std::fixed << std::setprecision(2)
+           << n / seconds / 1e6 << " Mhits/s"
+           << std::setw(14) << checksum << G4endl;
+}
+
+
+void BenchmarkIndexing(Options options) {
+    unsigned int n = options.size;
+    std::vector<unsigned int> shape(3, n);
+    std::vector<double> spacing(3, 2.);
+
+    // Geometry voxels half the size of the scoring voxels
+    std::vector<unsigned int> geometry_shape(3, 2*n);
+    std::vector<double> geometry_spacing(3, 1.);
+
+    G4VoxelScoringGrid aligned(shape, spacing);
+    aligned.SetGeometryGrid(geometry_shape, geometry_spacing);
+
+    G4VoxelScoringGrid shifted(shape, spacing, G4ThreeVector(0.3, 0.3, 0.3));
+
+    G4double half = n * spacing[0] / 2.;
+
+    BenchmarkIndexing("replica", options.deposits, [&](Random& random) {
+        int x = random.Next(n), y = random.Next(n), z = random.Next(n);
+        return (G4long) x + y + z;
+    });
+
+    BenchmarkIndexing("replica table", options.deposits, [&](Random& random) {
+        int x = random.Next(2*n), y = random.Next(2*n), z = random.Next(2*n);
+        aligned.Map(x, y, z);
+        return (G4long) x + y + z;
+    });
+
+    BenchmarkIndexing("position", options.deposits, [&](Random& random) {
+        G4ThreeVector position(random.Next(1 << 20) * 2*half / (1 << 20) - half,
+                               random.Next(1 << 20) * 2*half / (1 << 20) - half,
+                               random.Next(1 << 20) * 2*half / (1 << 20) - half);
+        int x, y, z;
+        shifted.GetIndices(position, x, y, z);
+        return (G4long) x + y + z;
+    });
+
+    BenchmarkIndexing("split steps", options.deposits, [&](Random& random) {
+        G4ThreeVector start(random.Next(1 << 20) * 2*half / (1 << 20) - half,
+                            random.Next(1 << 20) * 2*half / (1 << 20) - half,
+                            random.Next(1 << 20) * 2*half / (1 << 20) - half);
+        G4ThreeVector step(random.Next(1000) / 250. - 2,
+                           random.Next(1000) / 250. - 2,
+                           random.Next(1000) / 250. - 2);
+        G4long sum = 0;
+        shifted.Traverse(start, start + step,
+                [&](int x, int y, int z, G4double) { sum += x + y + z; });
+        return sum;
+    });
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options;
+    options.threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+    options.deposits = argc > 2 ? atoi(argv[2]) : 10000000;
+    options.size = argc > 3 ? atoi(argv[3]) : 128;
+
+    G4cout << options.threads << " threads, " << options.deposits
+           << " deposits per thread, " << options.size << "^3 voxels" << G4endl;
+
+    FillReference(options);
+
+    Benchmark<double>("thread-local double", LOCAL_ACCUMULATION, options);
+    Benchmark<double>("atomic double", ATOMIC_ACCUMULATION, options);
+    Benchmark<float>("thread-local float", LOCAL_ACCUMULATION, options);
+    Benchmark<float>("atomic float", ATOMIC_ACCUMULATION, options);
+    Benchmark<float>("thread-local compensated", LOCAL_ACCUMULATION, options, true);
+    Benchmark<float>("atomic float, snapshots", ATOMIC_ACCUMULATION, options, false, true);
+    Benchmark<float>("thread-local, snapshots", LOCAL_ACCUMULATION, options, false, true);
+    Benchmark<G4VoxelFixedPoint>("thread-local fixed", LOCAL_ACCUMULATION, options);
+    Benchmark<G4VoxelFixedPoint>("atomic fixed", ATOMIC_ACCUMULATION, options);
+    Benchmark<double, G4VoxelSparseRecordArray<double> >(
+            "thread-local sparse", LOCAL_ACCUMULATION, options);
+    Benchmark<double, G4VoxelSparseRecordArray<double> >(
+            "atomic sparse", ATOMIC_ACCUMULATION, options);
+
+    BenchmarkIndexing(options);
+
+    return 0;
+}
+
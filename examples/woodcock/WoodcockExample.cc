@@ -0,0 +1,287 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+
+// Woodcock tracking against voxel by voxel tracking of photons. A cube of
+// water voxels with a slab of lung and a block of bone is irradiated by a
+// pencil beam of photons along z, and the energy deposited in each voxel
+// is scored by a G4VoxelDetector: first with the usual tracking, then with
+// G4VoxelWoodcockModel active. Prints the time of each run and, over the
+// voxels with at least 1% of the largest deposit, the ratio of the
+// energies and the mean squared difference in units of its uncertainty,
+// which should be close to 1.
+//
+//     WoodcockExample [events] [voxels per axis] [energy in MeV]
+
+#include "G4VoxelDataParameterisation.hh"
+#include "G4VoxelDetector.hh"
+#include "G4VoxelWoodcock.hh"
+
+// STL //
+#include <chrono>
+#include <map>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+
+// GEANT4 //
+#include "globals.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4RunManager.hh"
+#include "G4VUserDetectorConstruction.hh"
+#include "G4VUserPrimaryGeneratorAction.hh"
+#include "G4VModularPhysicsList.hh"
+#include "G4EmStandardPhysics_option4.hh"
+#include "G4EmParameters.hh"
+#include "G4FastSimulationPhysics.hh"
+#include "G4GlobalFastSimulationManager.hh"
+#include "G4ParticleGun.hh"
+#include "G4Gamma.hh"
+#include "G4Event.hh"
+#include "G4NistManager.hh"
+#include "G4SDManager.hh"
+#include "G4Box.hh"
+#include "G4LogicalVolume.hh"
+#include "G4PVPlacement.hh"
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+enum Phantom {
+    WATER,
+    LUNG,
+    BONE
+};
+
+
+class DetectorConstruction : public G4VUserDetectorConstruction {
+  public:
+    DetectorConstruction(unsigned int size) {
+        this->size = size;
+    };
+
+    G4VPhysicalVolume* Construct() {
+        G4NistManager* nist_manager = G4NistManager::Instance();
+
+        G4Box* world_solid = new G4Box("world_solid", size*mm, size*mm, size*mm);
+        G4LogicalVolume* world_logical = new G4LogicalVolume(world_solid,
+                nist_manager->FindOrBuildMaterial("G4_AIR"), "world_logical");
+        G4VPhysicalVolume* world_physical = new G4PVPlacement(0, G4ThreeVector(),
+                world_logical, "world_physical", 0, false, 0);
+
+        std::vector<unsigned int> shape(3, size);
+        std::vector<double> spacing(3, 1*mm);
+
+        array = new G4VoxelArray<short>(shape, spacing);
+        for (unsigned int z=0; z<size; z++) {
+            for (unsigned int y=0; y<size; y++) {
+                for (unsigned int x=0; x<size; x++) {
+                    short value = WATER;
+                    if (z >= size/4 && z < size/2) {
+                        value = LUNG;
+                    } else if (z >= size/2 && z < 3*size/4 &&
+                               x >= 3*size/8 && x < 5*size/8 &&
+                               y >= 3*size/8 && y < 5*size/8) {
+                        value = BONE;
+                    }
+                    (*array->array)[x + size*(y + size*z)] = value;
+                }
+            }
+        }
+
+        std::map<short, G4Material*> materials;
+        materials[WATER] = nist_manager->FindOrBuildMaterial("G4_WATER");
+        materials[LUNG] = nist_manager->FindOrBuildMaterial("G4_LUNG_ICRP");
+        materials[BONE] = nist_manager->FindOrBuildMaterial("G4_BONE_CORTICAL_ICRP");
+
+        parameterisation = new G4VoxelDataParameterisation<short>(array, materials,
+                                                                  world_physical);
+        parameterisation->Construct(G4ThreeVector(), 0);
+
+        envelope = new G4VoxelWoodcockEnvelope(parameterisation);
+
+        return world_physical;
+    };
+
+    void ConstructSDandField() {
+        detector = new G4VoxelDetector<double>("dose", array->GetShape(), array->GetSpacing());
+        // Woodcock steps deposit at their post-step point
+        detector->SetIndexing(POSITION_INDEXING);
+        detector->SetVariance(HISTORY_VARIANCE);
+
+        G4SDManager::GetSDMpointer()->AddNewDetector(detector);
+        parameterisation->GetLogicalVolume()->SetSensitiveDetector(detector);
+
+        new G4VoxelWoodcockModel(envelope, "woodcock");
+    };
+
+  public:
+    unsigned int size;
+
+    G4VoxelArray<short>* array;
+    G4VoxelDataParameterisation<short>* parameterisation;
+    G4VoxelWoodcockEnvelope* envelope;
+    G4VoxelDetector<double>* detector;
+};
+
+
+class PrimaryGeneratorAction : public G4VUserPrimaryGeneratorAction {
+  public:
+    PrimaryGeneratorAction(unsigned int size, G4double energy) {
+        gun = new G4ParticleGun(1);
+        gun->SetParticleDefinition(G4Gamma::Definition());
+        gun->SetParticleEnergy(energy);
+        gun->SetParticlePosition(G4ThreeVector(0, 0, -(size/2. + 1)*mm));
+        gun->SetParticleMomentumDirection(G4ThreeVector(0, 0, 1));
+    };
+
+    ~PrimaryGeneratorAction() {
+        delete gun;
+    };
+
+    void GeneratePrimaries(G4Event* event) {
+        gun->GeneratePrimaryVertex(event);
+    };
+
+  private:
+    G4ParticleGun* gun;
+};
+
+
+class PhysicsList : public G4VModularPhysicsList {
+  public:
+    PhysicsList() {
+        RegisterPhysics(new G4EmStandardPhysics_option4());
+
+        G4FastSimulationPhysics* fast_simulation = new G4FastSimulationPhysics();
+        fast_simulation->ActivateFastSimulation("gamma");
+        RegisterPhysics(fast_simulation);
+
+        G4EmParameters::Instance()->SetGeneralProcessActive(false);
+    };
+
+    void SetCuts() {
+        SetCutValue(0.1*mm, "gamma");
+        SetCutValue(0.1*mm, "e-");
+        SetCutValue(0.1*mm, "e+");
+    };
+};
+
+
+// Energy and sum of squares per voxel scored so far.
+void GetSums(G4VoxelDetector<double>* detector,
+             std::vector<double>& sum, std::vector<double>& sumsq)
+{
+    G4VoxelArray<double>* energy = detector->GetEnergyValues();
+    G4VoxelArray<double>* energysq = detector->GetEnergySqValues();
+
+    sum = *energy->array;
+    sumsq = *energysq->array;
+
+    delete energy->GetData();
+    delete energy;
+    delete energysq->GetData();
+    delete energysq;
+}
+
+
+int main(int argc, char** argv)
+{
+    G4int events = argc > 1 ? atoi(argv[1]) : 100000;
+    unsigned int size = argc > 2 ? atoi(argv[2]) : 100;
+    G4double energy = (argc > 3 ? atof(argv[3]) : 1.) * MeV;
+
+    G4RunManager* run_manager = new G4RunManager;
+
+    DetectorConstruction* detector_construction = new DetectorConstruction(size);
+    run_manager->SetUserInitialization(detector_construction);
+    run_manager->SetUserInitialization(new PhysicsList);
+    run_manager->SetUserAction(new PrimaryGeneratorAction(size, energy));
+    run_manager->Initialize();
+
+    G4GlobalFastSimulationManager* fast_simulation =
+        G4GlobalFastSimulationManager::GetGlobalFastSimulationManager();
+
+    // The detector keeps adding up, so the second run is the difference.
+    std::vector<double> sum[2];
+    std::vector<double> sumsq[2];
+    double seconds[2];
+
+    for (unsigned int i=0; i<2; i++) {
+        if (i == 0) {
+            fast_simulation->InActivateFastSimulationModel("woodcock");
+        } else {
+            fast_simulation->ActivateFastSimulationModel("woodcock");
+        }
+
+        Clock::time_point start = Clock::now();
+        run_manager->BeamOn(events);
+        seconds[i] = std::chrono::duration<double>(Clock::now() - start).count();
+
+        GetSums(detector_construction->detector, sum[i], sumsq[i]);
+    }
+
+    for (size_t j=0; j<sum[1].size(); j++) {
+        sum[1][j] -= sum[0][j];
+        sumsq[1][j] -= sumsq[0][j];
+    }
+
+    G4double maximum = *std::max_element(sum[0].begin(), sum[0].end());
+    G4double total[2] = {0, 0};
+    G4double squares = 0;
+    G4int voxels = 0;
+
+    for (size_t j=0; j<sum[0].size(); j++) {
+        total[0] += sum[0][j];
+        total[1] += sum[1][j];
+
+        if (sum[0][j] < 0.01*maximum) continue;
+
+        // Variance of each sum, from the history by history sums of squares
+        G4double variance = sumsq[0][j] - sum[0][j]*sum[0][j]/events
+                          + sumsq[1][j] - sum[1][j]*sum[1][j]/events;
+        if (variance <= 0) continue;
+
+        G4double difference = sum[1][j] - sum[0][j];
+        squares += difference*difference / variance;
+        voxels++;
+    }
+
+    G4cout << std::fixed << std::setprecision(2)
+           << "standard " << seconds[0] << " s, woodcock " << seconds[1] << " s, speedup "
+           << seconds[0] / seconds[1] << G4endl
+           << std::setprecision(4)
+           << "energy ratio " << total[1] / total[0] << ", mean squared deviation "
+           << squares / std::max(voxels, 1) << " over " << voxels << " voxels" << G4endl;
+
+    delete run_manager;
+
+    return 0;
+}
+
@@ -0,0 +1,427 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef DICOMARCHIVEDATAIO_H
+#define DICOMARCHIVEDATAIO_H
+
+// G4VoxelData //
+#include "G4VoxelData.hh"
+#include "DicomDataIO.hh"
+
+// STL //
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <streambuf>
+#include <istream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <set>
+
+// Grassroots DICOM Library //
+#include "gdcmReader.h"
+#include "gdcmImageReader.h"
+
+// libarchive //
+#include "archive.h"
+#include "archive_entry.h"
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// Reads a DICOM series straight out of a zip or (compressed) tar archive,
+// without extracting it to disk. Members are decompressed into memory in
+// archive order, which libarchive can only do sequentially, then parsed,
+// filtered and decoded by gdcm on several threads. Modality and acquisition
+// number filtering and sorting along the slice normal follow `DicomDataIO`.
+class DicomArchiveDataIO : public DicomDataIO {
+  public:
+    DicomArchiveDataIO() {
+        this->threads = std::thread::hardware_concurrency();
+        if (this->threads == 0) this->threads = 1;
+    };
+
+    void SetThreads(unsigned int threads) {
+        this->threads = std::max(threads, 1u);
+    };
+
+    unsigned int GetThreads() {
+        return this->threads;
+    };
+
+    // Archives are read as a series, anything else as by `DicomDataIO`.
+    G4VoxelData* Read(G4String filename) {
+        if (IsArchive(filename)) {
+            return ReadArchive(filename);
+        }
+        return DicomDataIO::Read(filename);
+    };
+
+    G4VoxelData* ReadArchive(G4String filename) {
+        std::string prefix = "DicomArchiveDataIO::ReadArchive: ";
+        logger->message << prefix << "Reading members of " << filename << std::endl;
+
+        std::vector<Member> members;
+        if (!Extract(filename, members)) {
+            logger->error << prefix << "Cannot read archive " << filename << std::endl;
+            return NULL;
+        }
+        logger->message << prefix << "Found " << members.size() << " files in " << filename << std::endl;
+
+        // Parse, filter and decode on a pool of threads, each taking the
+        // next unclaimed member.
+        std::vector<Slice> slices(members.size());
+        std::atomic<unsigned int> next(0);
+
+        G4VoxelDataIOStats::Timer decode_timer(&stats, "members");
+        std::vector<std::thread> pool;
+        for (unsigned int i=0; i<std::min<size_t>(threads, members.size()); i++) {
+            pool.push_back(std::thread([this, &members, &slices, &next]() {
+                for (unsigned int m=next++; m<members.size(); m=next++) {
+                    DecodeMember(members[m], slices[m]);
+                }
+            }));
+        }
+        for (unsigned int i=0; i<pool.size(); i++) pool[i].join();
+        decode_timer.Stop();
+
+        std::vector<Slice> selected;
+        for (unsigned int i=0; i<slices.size(); i++) {
+            if (slices[i].error) {
+                logger->error << prefix << "Cannot read data from member " << members[i].name << std::endl;
+            }
+            if (slices[i].data) selected.push_back(slices[i]);
+        }
+        members.clear();
+
+        if (selected.size() == 0) {
+            logger->error << prefix << "No files of modality " << modality;
+            if (acquisition_number > 0) logger->error << " and acquisition number " << acquisition_number;
+            logger->error << " in " << filename << std::endl;
+            return NULL;
+        }
+        logger->message << prefix << "Found " << selected.size() << " " << modality << " files." << std::endl;
+
+        // Sort the slices along the z-axis for stacking as a 3D array.
+        if (sort == true) {
+            G4VoxelDataIOStats::Timer sort_timer(&stats, "sort");
+            std::stable_sort(selected.begin(), selected.end(), CompareSlices);
+        }
+
+        G4VoxelDataIOStats::Timer stack_timer(&stats, "stack");
+        G4VoxelData* voxel_data = selected.front().data;
+        double first_position = voxel_data->origin[2];
+        double last_position = first_position;
+
+        voxel_data->array->reserve(voxel_data->array->size() * selected.size());
+        for (unsigned int i=1; i<selected.size(); i++) {
+            G4VoxelData* vd = selected[i].data;
+            voxel_data->array->insert(voxel_data->array->end(),
+                                      vd->array->begin(), vd->array->end());
+            voxel_data->length += vd->length;
+            voxel_data->shape[2] += vd->shape[2];
+
+            last_position = vd->origin[2];
+            Release(vd);
+        }
+        stack_timer.Stop(voxel_data->array->size());
+
+        CentreStack(voxel_data, first_position, last_position);
+
+        ReportStats();
+
+        return voxel_data;
+    };
+
+    // zip and tar archives are recognised by their headers, compressed tar
+    // archives by compression header and extension.
+    static G4int Sniff(G4String filename) {
+        if (HasMagic(filename, 0, "PK\x03\x04")) return SNIFF_CONTENT;
+        if (HasMagic(filename, 257, "ustar")) return SNIFF_CONTENT;
+
+        G4bool compressed = HasMagic(filename, 0, "\x1f\x8b")
+                         || HasMagic(filename, 0, "BZh")
+                         || HasMagic(filename, 0, "\xfd" "7zXZ");
+        if (compressed && IsArchive(filename)) return SNIFF_CONTENT;
+        if (IsArchive(filename)) return SNIFF_EXTENSION;
+
+        return SNIFF_NONE;
+    };
+
+    static G4bool IsDirect() {
+        return false;
+    };
+
+    static G4bool IsArchive(G4String filename) {
+        const char* extensions[] = {".zip", ".tar", ".tar.gz", ".tgz",
+                                    ".tar.bz2", ".tbz2", ".tar.xz", ".txz"};
+        for (unsigned int i=0; i<sizeof(extensions)/sizeof(extensions[0]); i++) {
+            if (HasExtension(filename, extensions[i])) return true;
+        }
+        return false;
+    };
+
+  private:
+    struct Member {
+        std::string name;
+        std::vector<char> bytes;
+    };
+
+    struct Slice {
+        Slice() : data(NULL), position(0), error(false) {};
+
+        G4VoxelData* data;
+        double position;    // along the slice normal
+        G4bool error;
+    };
+
+    // Lets gdcm read a member in place, without copying it into a stream.
+    class MemoryBuffer : public std::streambuf {
+      public:
+        MemoryBuffer(char* begin, size_t length) {
+            setg(begin, begin, begin + length);
+        };
+
+      protected:
+        pos_type seekoff(off_type offset, std::ios_base::seekdir direction,
+                         std::ios_base::openmode) {
+            char* target = eback();
+            if (direction == std::ios_base::cur) target = gptr();
+            if (direction == std::ios_base::end) target = egptr();
+            target += offset;
+
+            if (target < eback() || target > egptr()) return pos_type(off_type(-1));
+
+            setg(eback(), target, egptr());
+            return pos_type(target - eback());
+        };
+
+        pos_type seekpos(pos_type position, std::ios_base::openmode mode) {
+            return seekoff(off_type(position), std::ios_base::beg, mode);
+        };
+    };
+
+  private:
+    // Decompress every regular file in the archive into memory. Returns
+    // false, with the error logged, unless the whole archive was read: a
+    // truncated or corrupt archive would otherwise give a partial series.
+    G4bool Extract(G4String filename, std::vector<Member>& members) {
+        G4VoxelDataIOStats::Timer extract_timer(&stats, "extract");
+
+        struct archive* archive = archive_read_new();
+        archive_read_support_filter_all(archive);
+        archive_read_support_format_all(archive);
+
+        if (archive_read_open_filename(archive, filename.c_str(), 1 << 20) != ARCHIVE_OK) {
+            logger->error << "DicomArchiveDataIO::Extract: Cannot open " << filename
+                          << ": " << archive_error_string(archive) << std::endl;
+            archive_read_free(archive);
+            return false;
+        }
+
+        struct archive_entry* entry;
+        unsigned long long bytes = 0;
+        int status;
+        while ((status = archive_read_next_header(archive, &entry)) != ARCHIVE_EOF) {
+            if (status != ARCHIVE_OK) {
+                logger->error << "DicomArchiveDataIO::Extract: Cannot read "
+                              << filename << " past member " << members.size()
+                              << ": " << archive_error_string(archive) << std::endl;
+                archive_read_free(archive);
+                return false;
+            }
+
+            if (archive_entry_filetype(entry) != AE_IFREG) {
+                if (archive_read_data_skip(archive) != ARCHIVE_OK) {
+                    logger->error << "DicomArchiveDataIO::Extract: Cannot skip "
+                                  << archive_entry_pathname(entry) << ": "
+                                  << archive_error_string(archive) << std::endl;
+                    archive_read_free(archive);
+                    return false;
+                }
+                continue;
+            }
+
+            members.push_back(Member());
+            Member& member = members.back();
+            member.name = archive_entry_pathname(entry);
+
+            // Sizes are not always known up front, read in blocks until done.
+            size_t length = archive_entry_size_is_set(entry) ?
+                archive_entry_size(entry) : 0;
+            member.bytes.resize(std::max<size_t>(length, 1 << 16));
+
+            size_t read = 0;
+            la_ssize_t n;
+            while ((n = archive_read_data(archive, &member.bytes[read],
+                                          member.bytes.size() - read)) > 0) {
+                read += n;
+                if (read == member.bytes.size()) member.bytes.resize(2*read);
+            }
+            member.bytes.resize(read);
+            bytes += read;
+
+            if (n < 0) {
+                logger->error << "DicomArchiveDataIO::Extract: Cannot read member "
+                              << member.name << ": " << archive_error_string(archive) << std::endl;
+                archive_read_free(archive);
+                return false;
+            }
+        }
+
+        archive_read_free(archive);
+
+        extract_timer.Stop(bytes);
+        stats.AddFilesScanned(members.size());
+        stats.AddBytesRead(bytes);
+
+        return true;
+    };
+
+    // Runs on the worker threads. Members that are not images of the
+    // requested modality and acquisition are skipped before decoding, as
+    // are members gdcm cannot read the tags of, which the gdcm::Scanner of
+    // DicomDataIO leaves out of a directory in the same way.
+    void DecodeMember(Member& member, Slice& slice) {
+        if (member.bytes.empty()) return;
+
+        MemoryBuffer memory(&member.bytes.front(), member.bytes.size());
+        std::istream stream(&memory);
+
+        gdcm::Tag modality_tag(0x08, 0x60);
+        gdcm::Tag acquisition_tag(0x20, 0x12);
+
+        std::set<gdcm::Tag> tags;
+        tags.insert(modality_tag);
+        tags.insert(acquisition_tag);
+
+        gdcm::Reader header;
+        header.SetStream(stream);
+
+        try {
+            if (!header.ReadSelectedTags(tags)) return;
+        } catch (...) {
+            return;
+        }
+
+        const gdcm::DataSet& selection = header.GetFile().GetDataSet();
+
+        if (GetTagValue(selection, modality_tag) != std::string(modality)) {
+            return;
+        }
+
+        if (acquisition_number > 0 &&
+            std::atoi(GetTagValue(selection, acquisition_tag).c_str()) != acquisition_number) {
+            return;
+        }
+
+        stream.clear();
+        stream.seekg(0);
+
+        gdcm::ImageReader reader;
+        reader.SetStream(stream);
+
+        try {
+            if (!reader.Read()) {
+                slice.error = true;
+                return;
+            }
+        } catch (...) {
+            slice.error = true;
+            return;
+        }
+
+        const gdcm::DataSet& dataset = reader.GetFile().GetDataSet();
+
+        double image_slope = override_slope ? slope : reader.GetImage().GetSlope();
+        double image_intercept = override_intercept ? intercept : reader.GetImage().GetIntercept();
+
+        slice.data = ReadImage(reader, image_slope, image_intercept);
+        slice.position = GetSlicePosition(dataset);
+
+        // The encoded member is no longer needed.
+        std::vector<char>().swap(member.bytes);
+    };
+
+    // Value of a string tag with DICOM padding removed.
+    static std::string GetTagValue(const gdcm::DataSet& dataset, gdcm::Tag tag) {
+        if (!dataset.FindDataElement(tag)) return "";
+
+        const gdcm::ByteValue* value = dataset.GetDataElement(tag).GetByteValue();
+        if (!value) return "";
+
+        std::string text(value->GetPointer(), value->GetLength());
+        std::string padding(" \0", 2);
+        size_t first = text.find_first_not_of(padding);
+        size_t last = text.find_last_not_of(padding);
+        if (first == std::string::npos) return "";
+
+        return text.substr(first, last - first + 1);
+    };
+
+    // Image position projected onto the slice normal, as `gdcm::IPPSorter`.
+    static double GetSlicePosition(const gdcm::DataSet& dataset) {
+        std::vector<double> position = GetTagValues(dataset, gdcm::Tag(0x20, 0x32));
+        std::vector<double> orientation = GetTagValues(dataset, gdcm::Tag(0x20, 0x37));
+
+        if (position.size() != 3) return 0;
+        if (orientation.size() != 6) return position[2];
+
+        double normal[3] = {
+            orientation[1]*orientation[5] - orientation[2]*orientation[4],
+            orientation[2]*orientation[3] - orientation[0]*orientation[5],
+            orientation[0]*orientation[4] - orientation[1]*orientation[3]
+        };
+
+        return normal[0]*position[0] + normal[1]*position[1] + normal[2]*position[2];
+    };
+
+    // Backslash separated decimal strings, e.g. image position.
+    static std::vector<double> GetTagValues(const gdcm::DataSet& dataset, gdcm::Tag tag) {
+        std::vector<double> values;
+        std::istringstream text(GetTagValue(dataset, tag));
+
+        std::string value;
+        while (std::getline(text, value, '\\')) {
+            values.push_back(std::atof(value.c_str()));
+        }
+        return values;
+    };
+
+    static bool CompareSlices(const Slice& a, const Slice& b) {
+        return a.position < b.position;
+    };
+
+  private:
+    unsigned int threads;
+};
+
+#endif // DICOMARCHIVEDATAIO_H
+
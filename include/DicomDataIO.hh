@@ -36,6 +36,7 @@
 // STL //
 #include <vector>
 #include <string>
+#include <algorithm>
 
 // Grassroots DICOM Library //
 #include "gdcmDirectory.h"
@@ -43,6 +44,7 @@
 #include "gdcmIPPSorter.h"
 #include "gdcmScanner.h"
 #include "gdcmRescaler.h"
+#include "gdcmSystem.h"
 
 // GEANT4 //
 #include "globals.hh"
@@ -103,14 +105,20 @@ class DicomDataIO : public G4VoxelDataIO {
         return ReadDirectory(G4String(directory));
     };
 
-    G4VoxelData* ReadDirectory(G4String directory)
+    // Find the files in `directory` matching the modality and acquisition
+    // number, sorted along z if requested.
+    std::vector<std::string> ScanDirectory(G4String directory)
     {
-        std::string prefix = "DicomDataIO::ReadDirectory: ";
+        std::string prefix = "DicomDataIO::ScanDirectory: ";
         logger->message << prefix << "Reading files in " << directory << std::endl;
 
+        G4VoxelDataIOStats::Timer list_timer(&stats, "list");
         gdcm::Directory dir;
         dir.Load((const char*) directory.c_str());
         std::vector<std::string> input_filenames = dir.GetFilenames();
+        list_timer.Stop();
+
+        stats.AddFilesScanned(input_filenames.size());
 
         if (input_filenames.size() == 0) {
             logger->message << prefix << "Specified directory is empty." << std::endl;
@@ -128,7 +136,10 @@ class DicomDataIO : public G4VoxelDataIO {
         gdcm::Tag const acquisition_tag = gdcm::Tag(0x20, 0x12);
         scanner.AddTag(acquisition_tag);
 
+        G4VoxelDataIOStats::Timer scan_timer(&stats, "scan");
         scanner.Scan(input_filenames);
+        scan_timer.Stop();
+
         std::vector<std::string> filtered_filenames = 
             scanner.GetAllFilenamesFromTagToValue(modality_tag,
                                                   (const char*) modality.c_str());
@@ -140,7 +151,10 @@ class DicomDataIO : public G4VoxelDataIO {
         }
 
         if (acquisition_number > 0) {
+            G4VoxelDataIOStats::Timer acquisition_timer(&stats, "scan");
             scanner.Scan(filtered_filenames);
+            acquisition_timer.Stop();
+
             std::string aq_number = gdcm::to_string(acquisition_number);
             filtered_filenames = 
                 scanner.GetAllFilenamesFromTagToValue(acquisition_tag,
@@ -156,16 +170,32 @@ class DicomDataIO : public G4VoxelDataIO {
         // Sort the files along the z-axis for stacking as a 3D array.
         std::vector<std::string> filenames;
         if (sort == true) {
+            G4VoxelDataIOStats::Timer sort_timer(&stats, "sort");
             gdcm::IPPSorter sorter;
             sorter.SetComputeZSpacing(false);
             sorter.Sort(filtered_filenames);
             filenames = sorter.GetFilenames();
+            sort_timer.Stop();
 
             if (filenames.size() == 0)
                 logger->error << prefix << "Files could not be sorted, check acquisition number" << std::endl;
         } else {
             filenames = filtered_filenames;
         }
+
+        return filenames;
+    };
+
+    G4VoxelData* ReadDirectory(G4String directory)
+    {
+        std::vector<std::string> filenames = ScanDirectory(directory);
+
+        if (filenames.empty()) {
+            logger->error << "DicomDataIO::ReadDirectory: No images in " << directory
+                          << std::endl;
+            return NULL;
+        }
+
         // Populate G4VoxelData with stacked slices.
         G4VoxelData* voxel_data = Read(filenames[0].c_str());
 
@@ -174,8 +204,12 @@ class DicomDataIO : public G4VoxelDataIO {
 
         for (unsigned int i=1; i<filenames.size(); i++) {
             G4VoxelData* vd = Read(filenames[i].c_str());
+
+            G4VoxelDataIOStats::Timer stack_timer(&stats, "stack");
             voxel_data->array->insert(voxel_data->array->end(),
                                       vd->array->begin(), vd->array->end());
+            stack_timer.Stop(vd->array->size());
+
             voxel_data->length += vd->length;
             voxel_data->shape[2] += vd->shape[2];
             
@@ -183,40 +217,139 @@ class DicomDataIO : public G4VoxelDataIO {
                 last_position = vd->origin[2];
         }
 
-        voxel_data->ndims = 3;
-
-        // Coerce the origin to the centre of the dataset.
-        voxel_data->origin[0] = voxel_data->origin[0]
-                              + voxel_data->shape[0]*voxel_data->spacing[0]/2;
-        voxel_data->origin[1] = voxel_data->origin[1]
-                              + voxel_data->shape[1]*voxel_data->spacing[1]/2;
-        voxel_data->origin[2] = first_position
-                              + (last_position - first_position)/2;
+        CentreStack(voxel_data, first_position, last_position);
 
-        voxel_data->order = ROW_MAJOR;
+        ReportStats();
 
         return voxel_data;
     };
 
+    // Scan, sort and stack the directory on a background thread, see
+    // `G4VoxelDataIO::ReadAsync`.
+    std::shared_future<G4VoxelData*> ReadDirectoryAsync(G4String directory) {
+        return std::async(std::launch::async,
+                          &DicomDataIO::ReadDirectory, this, directory).share();
+    };
+
+    std::shared_future<G4VoxelData*> ReadDirectoryAsync(G4String directory,
+                                                        ReadCallback callback) {
+        return std::async(std::launch::async, [this, directory, callback]() {
+            G4VoxelData* data = this->ReadDirectory(directory);
+            callback(data);
+            return data;
+        }).share();
+    };
+
+    // Streaming reads treat each file in the sorted series as one
+    // z-slice, only the slices spanned by a chunk are decoded.
+    G4VoxelData* ReadHeader(G4String directory) {
+        header = NULL;
+        slab_filenames = ScanDirectory(directory);
+
+        if (slab_filenames.empty()) {
+            logger->error << "DicomDataIO::ReadHeader: No images in " << directory
+                          << std::endl;
+            return NULL;
+        }
+
+        G4VoxelData* first = Read(slab_filenames.front().c_str());
+        G4VoxelData* last = Read(slab_filenames.back().c_str());
+
+        std::vector<unsigned int> shape(first->shape.begin(), first->shape.begin() + 3);
+        shape[2] = slab_filenames.size();
+        std::vector<double> spacing(first->spacing.begin(), first->spacing.begin() + 3);
+
+        // Same centring as `ReadDirectory`.
+        std::vector<double> origin(first->origin.begin(), first->origin.begin() + 3);
+        origin[0] += shape[0]*spacing[0]/2;
+        origin[1] += shape[1]*spacing[1]/2;
+        origin[2] += (last->origin[2] - first->origin[2])/2;
+
+        header = new G4VoxelData(NULL, shape[0]*shape[1]*shape[2], 3,
+                                 shape, spacing, origin, INT16, ROW_MAJOR);
+
+        Release(first);
+        Release(last);
+
+        return header;
+    };
+
+    G4VoxelData* ReadChunk(std::vector<unsigned int> offset,
+                           std::vector<unsigned int> shape) {
+        size_t row = shape[0]*sizeof(int16_t);
+        std::vector<char>* buffer =
+            new std::vector<char>(row*shape[1]*shape[2]);
+        char* out = &buffer->front();
+
+        for (unsigned int z=0; z<shape[2]; z++) {
+            G4VoxelData* slice = Read(slab_filenames[offset[2] + z].c_str());
+
+            G4VoxelDataIOStats::Timer crop_timer(&stats, "crop");
+            for (unsigned int y=0; y<shape[1]; y++) {
+                size_t index = offset[0] + (size_t) slice->shape[0]*(offset[1] + y);
+                std::copy(slice->array->begin() + index*sizeof(int16_t),
+                          slice->array->begin() + index*sizeof(int16_t) + row, out);
+                out += row;
+            }
+            crop_timer.Stop(row*shape[1]);
+
+            Release(slice);
+        }
+
+        return MakeChunk(buffer, offset, shape);
+    };
+
     G4VoxelData* _Read(char* filename) {
         return Read(G4String(filename));
     };
 
     G4VoxelData* Read(G4String filename) {
+        if (gdcm::Directory::IsDirectory(filename.c_str())) {
+            return ReadDirectory(filename);
+        }
+
         std::string prefix = "DicomDataIO::Read";
         logger->message << prefix << "Reading: " << filename << std::endl;
 
         gdcm::ImageReader* reader = new gdcm::ImageReader();
         reader->SetFileName((const char*) filename.c_str());
 
+        G4VoxelDataIOStats::Timer read_timer(&stats, "read");
         try {
             reader->Read();
         } catch (...) {
             logger->error << prefix << "Cannot read data from file " << filename << std::endl;
         }
 
+        size_t file_size = gdcm::System::FileSize((const char*) filename.c_str());
+        read_timer.Stop(file_size);
+        stats.AddBytesRead(file_size);
+
         gdcm::Image* image = &reader->GetImage();
-        gdcm::DataSet* file = &reader->GetFile().GetDataSet();
+
+        if (!override_slope) {
+            slope = image->GetSlope();
+            logger->debug << prefix << "Setting slope as read from file to " << slope << std::endl;
+        }
+
+        if (!override_intercept) {
+            intercept = image->GetIntercept();
+            logger->debug << prefix << "Setting intercept as read from file to " << intercept << std::endl;
+        }
+
+        G4VoxelData* voxel_data = ReadImage(*reader, slope, intercept);
+
+        delete reader;
+
+        return voxel_data;
+    };
+
+    // Decode the image held by `reader` into int16 values rescaled with
+    // `slope` and `intercept`. Neither logs nor modifies the reader
+    // settings, so images may be decoded on several threads at once.
+    G4VoxelData* ReadImage(gdcm::ImageReader& reader, double slope, double intercept) {
+        gdcm::Image* image = &reader.GetImage();
+        gdcm::DataSet* file = &reader.GetFile().GetDataSet();
         
         unsigned int ndims = (unsigned int) image->GetNumberOfDimensions();
         unsigned int buffer_length = (unsigned int) image->GetBufferLength();
@@ -241,18 +374,13 @@ class DicomDataIO : public G4VoxelDataIO {
 
         char* buffer_in = new char[buffer_length];
         char* buffer_out = new char[buffer_length];
-        image->GetBuffer(buffer_in);
-
-        if (!override_slope) {
-            slope = image->GetSlope();
-            logger->debug << prefix << "Setting slope as read from file to " << slope << std::endl;
-        }
 
-        if (!override_intercept) {
-            intercept = image->GetIntercept();
-            logger->debug << prefix << "Setting intercept as read from file to " << intercept << std::endl;
-        }
+        G4VoxelDataIOStats::Timer decode_timer(&stats, "decode");
+        image->GetBuffer(buffer_in);
+        decode_timer.Stop(buffer_length);
+        stats.AddBytesDecoded(buffer_length);
 
+        G4VoxelDataIOStats::Timer rescale_timer(&stats, "rescale");
         gdcm::Rescaler rescaler = gdcm::Rescaler();
         rescaler.SetIntercept(intercept);
         rescaler.SetSlope(slope);
@@ -260,18 +388,66 @@ class DicomDataIO : public G4VoxelDataIO {
         rescaler.SetMinMaxForPixelType(((gdcm::PixelFormat)INT16).GetMin(),
                                        ((gdcm::PixelFormat)INT16).GetMax());
         rescaler.Rescale(buffer_out, buffer_in, buffer_length);        
+        rescale_timer.Stop(buffer_length);
 
+        G4VoxelDataIOStats::Timer copy_timer(&stats, "copy");
         std::vector<char>* buffer =
             new std::vector<char>(buffer_out, buffer_out + buffer_length);
+        copy_timer.Stop(buffer_length);
 
         // Clean up buffers
-        delete reader;
         delete buffer_in;
         delete buffer_out;
 
         return new G4VoxelData(buffer, buffer_length/sizeof(int16_t), ndims, shape, spacing, origin, INT16);
     };
   
+    // Files carry "DICM" after a 128 byte preamble, though some older files
+    // omit it. A directory is accepted if one of its first files is DICOM.
+    static G4int Sniff(G4String filename) {
+        if (gdcm::Directory::IsDirectory(filename.c_str())) {
+            gdcm::Directory dir;
+            dir.Load((const char*) filename.c_str());
+            std::vector<std::string> filenames = dir.GetFilenames();
+
+            for (unsigned int i=0; i<filenames.size() && i<8; i++) {
+                if (HasMagic(filenames[i], 128, "DICM")) return SNIFF_CONTENT;
+            }
+            return SNIFF_NONE;
+        }
+
+        if (HasMagic(filename, 128, "DICM")) return SNIFF_CONTENT;
+        if (HasExtension(filename, ".dcm")) return SNIFF_EXTENSION;
+        return SNIFF_NONE;
+    };
+
+    static G4bool IsDirect() {
+        return false;
+    };
+
+  protected:
+    // Finish a z-stack of slices, the first of which is `voxel_data`.
+    void CentreStack(G4VoxelData* voxel_data, double first_position,
+                     double last_position) {
+        voxel_data->ndims = 3;
+
+        // Coerce the origin to the centre of the dataset.
+        voxel_data->origin[0] = voxel_data->origin[0]
+                              + voxel_data->shape[0]*voxel_data->spacing[0]/2;
+        voxel_data->origin[1] = voxel_data->origin[1]
+                              + voxel_data->shape[1]*voxel_data->spacing[1]/2;
+        voxel_data->origin[2] = first_position
+                              + (last_position - first_position)/2;
+
+        voxel_data->order = ROW_MAJOR;
+    };
+
+    // Slices are only needed until they are copied into a chunk.
+    void Release(G4VoxelData* data) {
+        G4VoxelDataStore<G4VoxelData*>::DeRegister(data);
+        delete data;
+    };
+
  public:
     bool sort;
     G4String modality;
@@ -281,6 +457,9 @@ class DicomDataIO : public G4VoxelDataIO {
     double slope;
     bool override_intercept;
     double intercept;
+
+    // Sorted series opened by `ReadHeader`
+    std::vector<std::string> slab_filenames;
 };
 
 #endif // DICOMDATAIO_H
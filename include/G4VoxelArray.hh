@@ -509,7 +509,7 @@ class G4VoxelArray : public G4VoxelArrayBase<T> {
         this->array->assign(data->length,(T) 0);
     }
 
-    ~G4VoxelArray() {};
+    virtual ~G4VoxelArray() {};
 
     using G4VoxelArrayBase<T>::GetIndex; 
   
@@ -616,7 +616,7 @@ class G4VoxelArray<std::complex<T> > : public G4VoxelArrayBase<T> {
         this->array = reinterpret_cast<std::vector<std::complex<T> >*>(data->array);
     };
 
-    ~G4VoxelArray() {};
+    virtual ~G4VoxelArray() {};
 
     using G4VoxelArrayBase<T>::GetIndex; 
     
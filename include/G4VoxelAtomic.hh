@@ -0,0 +1,77 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELATOMIC_H
+#define G4VOXELATOMIC_H
+
+// STL //
+#include <atomic>
+#include <type_traits>
+
+
+// Lock-free `*address += value` on plain storage, for histograms that are
+// shared between threads. The storage is treated as a `std::atomic<T>`,
+// which has the same size and alignment as T for the arithmetic types
+// used for scoring. Integers use a native fetch-add, floating point types
+// a compare-and-swap loop. Ordering is relaxed: the sums are only read once
+// the threads filling them have been joined (e.g. at the end of a run).
+template <typename T>
+inline void G4VoxelAtomicAdd(T* address, T value, std::true_type) {
+    reinterpret_cast<std::atomic<T>*>(address)->fetch_add(value,
+            std::memory_order_relaxed);
+}
+
+template <typename T>
+inline void G4VoxelAtomicAdd(T* address, T value, std::false_type) {
+    std::atomic<T>* target = reinterpret_cast<std::atomic<T>*>(address);
+
+    T expected = target->load(std::memory_order_relaxed);
+    while (!target->compare_exchange_weak(expected, expected + value,
+                std::memory_order_relaxed)) {
+        // `expected` now holds the current value, try again
+    }
+}
+
+template <typename T>
+inline void G4VoxelAtomicAdd(T* address, T value) {
+    static_assert(sizeof(std::atomic<T>) == sizeof(T),
+                  "std::atomic<T> must have the layout of T");
+
+    G4VoxelAtomicAdd(address, value, typename std::is_integral<T>::type());
+}
+
+// Relaxed read of a value that other threads may be adding to with
+// G4VoxelAtomicAdd, e.g. to check on the sums while scoring.
+template <typename T>
+inline T G4VoxelAtomicLoad(const T* address) {
+    return reinterpret_cast<const std::atomic<T>*>(address)->load(
+            std::memory_order_relaxed);
+}
+
+#endif // G4VOXELATOMIC_H
+
@@ -0,0 +1,288 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+
+#ifndef G4VOXELBIASING_H
+#define G4VOXELBIASING_H
+
+// G4VOXELDATA //
+#include "G4VoxelArray.hh"
+#include "G4VoxelDataParameterisation.hh"
+
+// STL //
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cfloat>
+
+// GEANT4 //
+#include "globals.hh"
+#include "G4VBiasingOperator.hh"
+#include "G4VBiasingOperation.hh"
+#include "G4ParticleChange.hh"
+#include "G4Step.hh"
+#include "G4StepPoint.hh"
+#include "G4Track.hh"
+#include "G4VTouchable.hh"
+#include "Randomize.hh"
+
+
+// Splitting
+// =========
+// With IMPORTANCE_SPLITTING the map holds the importance of each voxel. A
+// track crossing into a voxel of importance I1 from one of I0 is split into
+// r = I1/I0 tracks on average (the fraction of r by a random extra copy,
+// at most `SetMaximumSplitting` copies) of weight w/r each if r > 1, and
+// survives Russian roulette with probability r at weight w/r if r < 1.
+// Voxels of importance 0 kill tracks entering them.
+//
+// With WEIGHT_WINDOW_SPLITTING the map holds the lower weight bound wL of
+// each voxel, 0 for no window, and tracks are checked on entering it as by
+// G4WeightWindowAlgorithm: below wL they survive roulette with probability
+// w/wS at weight wS = wL*`SetSurvivalFactor` (3), above
+// wU = wL*`SetUpperLimitFactor` (5) they are split into int(w/wU) tracks,
+// at most `SetMaximumSplitting`, sharing the weight.
+enum Splitting {
+    IMPORTANCE_SPLITTING,
+    WEIGHT_WINDOW_SPLITTING
+};
+
+
+template <typename T, typename U> class G4VoxelBiasingOperator;
+
+
+// Splits or kills a track, as its biasing operator decides, when a step
+// ends on a voxel boundary.
+template <typename T, typename U=T>
+class G4VoxelSplitOrKillOperation : public G4VBiasingOperation {
+  public:
+    G4VoxelSplitOrKillOperation(G4VoxelBiasingOperator<T, U>* biasing)
+        : G4VBiasingOperation("G4VoxelSplitOrKillOperation") {
+        this->biasing = biasing;
+    };
+
+    virtual ~G4VoxelSplitOrKillOperation() {};
+
+    // Not a physics biasing, only the final state of each step is changed
+    virtual const G4VBiasingInteractionLaw* ProvideOccurenceBiasingInteractionLaw(
+            const G4BiasingProcessInterface*, G4ForceCondition&) {
+        return 0;
+    };
+
+    virtual G4VParticleChange* ApplyFinalStateBiasing(
+            const G4BiasingProcessInterface*, const G4Track*, const G4Step*, G4bool&) {
+        return 0;
+    };
+
+    // Called at the end of every step, which is never limited by this.
+    virtual G4double DistanceToApplyOperation(const G4Track*, G4double,
+                                              G4ForceCondition* condition) {
+        *condition = Forced;
+        return DBL_MAX;
+    };
+
+    virtual G4VParticleChange* GenerateBiasingFinalState(const G4Track* track,
+                                                         const G4Step* step) {
+        particle_change.Initialize(*track);
+
+        if (step->GetPostStepPoint()->GetStepStatus() != fGeomBoundary) {
+            return &particle_change;
+        }
+
+        G4double weight = track->GetWeight();
+        G4int copies = 1;
+        G4double copy_weight = weight;
+
+        biasing->Decide(step, weight, copies, copy_weight);
+
+        if (copies == 0) {
+            particle_change.ProposeTrackStatus(fStopAndKill);
+        } else if (copies > 1 || copy_weight != weight) {
+            particle_change.ProposeParentWeight(copy_weight);
+            particle_change.SetSecondaryWeightByProcess(true);
+            particle_change.SetNumberOfSecondaries(copies - 1);
+
+            for (G4int i=1; i<copies; i++) {
+                G4Track* copy = new G4Track(*track);
+                copy->SetWeight(copy_weight);
+                particle_change.AddSecondary(copy);
+            }
+        }
+
+        return &particle_change;
+    };
+
+  private:
+    G4VoxelBiasingOperator<T, U>* biasing;
+    G4ParticleChange particle_change;
+};
+
+
+// Importance sampling or weight windows from a map over the placed voxels
+// of a G4VoxelDataParameterisation (the shape of its G4VoxelArray after
+// cropping and merging), applied as tracks cross voxel boundaries. Voxels
+// are looked up from the replica numbers as the parameterisation and
+// G4VoxelDetector do, with no navigation. Biasing operators are thread
+// local, so construct one in `ConstructSDandField` on every thread, after
+// the parameterisation has been constructed; it is attached to the voxel
+// logical volume. The particles to bias are chosen with
+// G4GenericBiasingPhysics:
+//
+//     G4GenericBiasingPhysics* biasing = new G4GenericBiasingPhysics();
+//     biasing->NonPhysicsBias("neutron");
+//     physics_list->RegisterPhysics(biasing);
+//
+//     // ConstructSDandField()
+//     new G4VoxelBiasingOperator<int16_t>(parameterisation, importance);
+//
+// Only boundaries between voxels are biased, tracks entering or leaving
+// the voxel volume are left alone.
+template <typename T, typename U=T>
+class G4VoxelBiasingOperator : public G4VBiasingOperator {
+  public:
+    G4VoxelBiasingOperator(G4VoxelDataParameterisation<T, U>* parameterisation,
+                           G4VoxelArray<float>* map,
+                           Splitting splitting=IMPORTANCE_SPLITTING)
+        : G4VBiasingOperator("G4VoxelBiasingOperator"), operation(this)
+    {
+        if (map->GetShape() != parameterisation->GetPlacedShape()) {
+            G4Exception("G4VoxelBiasingOperator", "ShapeMismatch", FatalException,
+                    "The map and the placed voxels differ in shape.");
+        }
+
+        this->parameterisation = parameterisation;
+        this->values = &map->array->front();
+        this->splitting = splitting;
+
+        this->maximum_splitting = 5;
+        this->upper_limit_factor = 5;
+        this->survival_factor = 3;
+
+        AttachTo(parameterisation->GetLogicalVolume());
+    };
+
+    virtual ~G4VoxelBiasingOperator() {};
+
+    // Most tracks a track may be split into at one boundary.
+    void SetMaximumSplitting(G4int maximum) {
+        this->maximum_splitting = std::max(maximum, 1);
+    };
+
+    void SetUpperLimitFactor(G4double factor) {
+        this->upper_limit_factor = factor;
+    };
+
+    void SetSurvivalFactor(G4double factor) {
+        this->survival_factor = factor;
+    };
+
+    Splitting GetSplitting() {
+        return this->splitting;
+    };
+
+    // Number of `copies` (0 to kill, 1 to leave the track be) and their
+    // weight for a track of `weight` at the end of `step`, see Splitting.
+    void Decide(const G4Step* step, G4double weight, G4int& copies,
+                G4double& copy_weight) {
+        const G4VTouchable* previous = step->GetPreStepPoint()->GetTouchable();
+        const G4VTouchable* next = step->GetPostStepPoint()->GetTouchable();
+        if (!parameterisation->IsVoxel(previous) || !parameterisation->IsVoxel(next)) {
+            return;
+        }
+
+        Decide(values[parameterisation->GetPlacedIndex(previous)],
+               values[parameterisation->GetPlacedIndex(next)],
+               weight, copies, copy_weight);
+    };
+
+    // As above, between voxels of map values `previous` and `value`.
+    void Decide(G4double previous, G4double value, G4double weight,
+                G4int& copies, G4double& copy_weight) {
+        if (splitting == IMPORTANCE_SPLITTING) {
+            G4double importance = previous;
+
+            if (value <= 0) {
+                copies = 0;
+                return;
+            }
+            if (importance <= 0 || value == importance) return;
+
+            G4double ratio = std::min<G4double>(value/importance, maximum_splitting);
+            if (ratio > 1) {
+                copies = (G4int) ratio;
+                if (G4UniformRand() < ratio - copies) copies++;
+                copy_weight = weight/ratio;
+            } else {
+                copies = G4UniformRand() < ratio ? 1 : 0;
+                copy_weight = weight/ratio;
+            }
+        } else {
+            if (value <= 0) return;
+
+            G4double survival = value*survival_factor;
+            G4double upper = value*upper_limit_factor;
+
+            if (weight < value) {
+                copies = G4UniformRand() < weight/survival ? 1 : 0;
+                copy_weight = survival;
+            } else if (weight > upper) {
+                copies = std::min<G4int>((G4int) (weight/upper), maximum_splitting);
+                copy_weight = weight/copies;
+            }
+        }
+    };
+
+  private:
+    virtual G4VBiasingOperation* ProposeNonPhysicsBiasingOperation(
+            const G4Track*, const G4BiasingProcessInterface*) {
+        return &operation;
+    };
+
+    virtual G4VBiasingOperation* ProposeOccurenceBiasingOperation(
+            const G4Track*, const G4BiasingProcessInterface*) {
+        return 0;
+    };
+
+    virtual G4VBiasingOperation* ProposeFinalStateBiasingOperation(
+            const G4Track*, const G4BiasingProcessInterface*) {
+        return 0;
+    };
+
+  private:
+    G4VoxelDataParameterisation<T, U>* parameterisation;
+    const float* values;
+    Splitting splitting;
+
+    G4int maximum_splitting;
+    G4double upper_limit_factor;
+    G4double survival_factor;
+
+    G4VoxelSplitOrKillOperation<T, U> operation;
+};
+
+#endif // G4VOXELBIASING_H
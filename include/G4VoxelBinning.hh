@@ -0,0 +1,169 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELBINNING_H
+#define G4VOXELBINNING_H
+
+// STL //
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// GEANT4 //
+#include "globals.hh"
+#include "G4Step.hh"
+#include "G4StepPoint.hh"
+
+
+// What a G4VoxelBinning bins steps by, read at the pre-step point.
+enum BinQuantity {
+    ENERGY_BINNING,
+    TIME_BINNING
+};
+
+enum BinSpacing {
+    UNIFORM_BINS,
+    LOG_BINS,
+    VARIABLE_BINS
+};
+
+
+// Bins over kinetic energy or global time for the spectra scored per voxel
+// by a G4VoxelDetector. Uniform and log-uniform bins are found with a
+// multiply-add, arbitrary edges by binary search.
+class G4VoxelBinning {
+  public:
+    G4VoxelBinning() {
+        this->quantity = ENERGY_BINNING;
+        this->spacing = VARIABLE_BINS;
+        this->lower = 0;
+        this->inverse_width = 0;
+    };
+
+    // `bins` bins of equal width from `min` to `max`.
+    static G4VoxelBinning Uniform(BinQuantity quantity, unsigned int bins,
+                                  G4double min, G4double max) {
+        G4VoxelBinning binning;
+        binning.quantity = quantity;
+        binning.spacing = UNIFORM_BINS;
+        binning.lower = min;
+        binning.inverse_width = bins/(max - min);
+
+        for (unsigned int i=0; i<=bins; i++) {
+            binning.edges.push_back(min + i*(max - min)/bins);
+        }
+
+        return binning;
+    };
+
+    // `bins` bins of equal width in log(value) from `min` to `max`, which
+    // must both be positive.
+    static G4VoxelBinning Log(BinQuantity quantity, unsigned int bins,
+                              G4double min, G4double max) {
+        G4VoxelBinning binning;
+        binning.quantity = quantity;
+        binning.spacing = LOG_BINS;
+        binning.lower = std::log(min);
+        binning.inverse_width = bins/(std::log(max) - std::log(min));
+
+        for (unsigned int i=0; i<=bins; i++) {
+            binning.edges.push_back(min * std::pow(max/min, (G4double) i/bins));
+        }
+
+        return binning;
+    };
+
+    // Bins between consecutive `edges`, which must be increasing.
+    static G4VoxelBinning Variable(BinQuantity quantity, std::vector<G4double> edges) {
+        G4VoxelBinning binning;
+        binning.quantity = quantity;
+        binning.spacing = VARIABLE_BINS;
+        binning.edges = edges;
+
+        return binning;
+    };
+
+    // Bin containing `value`, or -1 outside [first edge, last edge).
+    G4int GetBin(G4double value) const {
+        if (edges.size() < 2) return -1;
+        if (value < edges.front() || value >= edges.back()) return -1;
+
+        G4int bin;
+        if (spacing == UNIFORM_BINS) {
+            bin = (G4int) ((value - lower) * inverse_width);
+        } else if (spacing == LOG_BINS) {
+            bin = (G4int) ((std::log(value) - lower) * inverse_width);
+        } else {
+            bin = std::upper_bound(edges.begin(), edges.end(), value)
+                - edges.begin() - 1;
+        }
+
+        // Rounding at the top edge
+        return std::min(bin, (G4int) GetNumberOfBins() - 1);
+    };
+
+    G4double GetValue(const G4Step* step) const {
+        if (quantity == TIME_BINNING) {
+            return step->GetPreStepPoint()->GetGlobalTime();
+        }
+        return step->GetPreStepPoint()->GetKineticEnergy();
+    };
+
+    G4int GetBin(const G4Step* step) const {
+        return GetBin(GetValue(step));
+    };
+
+    unsigned int GetNumberOfBins() const {
+        return edges.size() < 2 ? 0 : edges.size() - 1;
+    };
+
+    std::vector<G4double> GetEdges() const {
+        return this->edges;
+    };
+
+    BinQuantity GetQuantity() const {
+        return this->quantity;
+    };
+
+    BinSpacing GetSpacing() const {
+        return this->spacing;
+    };
+
+  private:
+    BinQuantity quantity;
+    BinSpacing spacing;
+
+    std::vector<G4double> edges;
+
+    // bin = (value - lower) * inverse_width, of log(value) for LOG_BINS
+    G4double lower;
+    G4double inverse_width;
+};
+
+#endif // G4VOXELBINNING_H
+
@@ -0,0 +1,130 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELCOEFFICIENTTABLE_H
+#define G4VOXELCOEFFICIENTTABLE_H
+
+// STL //
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// Interpolation between the points of a G4VoxelCoefficientTable.
+enum Interpolation {
+    LINEAR_INTERPOLATION,
+    LOG_LOG_INTERPOLATION
+};
+
+
+// A coefficient tabulated against energy, e.g. E*mu_en/rho(E) to turn the
+// track length scored by a G4VoxelDetector into collision kerma. Points are
+// found by binary search and interpolated linearly or log-log (as tables
+// of attenuation coefficients usually are); energies outside the table take
+// the value at the nearest end.
+class G4VoxelCoefficientTable {
+  public:
+    G4VoxelCoefficientTable(Interpolation interpolation=LOG_LOG_INTERPOLATION) {
+        this->interpolation = interpolation;
+    };
+
+    // `energies` must be increasing, and with LOG_LOG_INTERPOLATION both
+    // energies and values positive.
+    G4VoxelCoefficientTable(std::vector<G4double> energies,
+                            std::vector<G4double> values,
+                            Interpolation interpolation=LOG_LOG_INTERPOLATION) {
+        this->interpolation = interpolation;
+
+        for (unsigned int i=0; i<energies.size(); i++) {
+            AddPoint(energies[i], values[i]);
+        }
+    };
+
+    // Add a point above all those already in the table.
+    void AddPoint(G4double energy, G4double value) {
+        if (!energies.empty() && energy <= energies.back()) {
+            G4Exception("G4VoxelCoefficientTable::AddPoint", "UnorderedEnergy",
+                    FatalException, "Energies must be added in increasing order.");
+            return;
+        }
+
+        energies.push_back(energy);
+        values.push_back(value);
+
+        if (interpolation == LOG_LOG_INTERPOLATION) {
+            x.push_back(std::log(energy));
+            y.push_back(std::log(value));
+        } else {
+            x.push_back(energy);
+            y.push_back(value);
+        }
+    };
+
+    G4double GetValue(G4double energy) const {
+        if (energies.empty()) return 0;
+        if (energy <= energies.front()) return values.front();
+        if (energy >= energies.back()) return values.back();
+
+        // First point above `energy`, so 0 < i < size
+        size_t i = std::upper_bound(energies.begin(), energies.end(), energy)
+                 - energies.begin();
+
+        G4double e = interpolation == LOG_LOG_INTERPOLATION ? std::log(energy) : energy;
+        G4double v = y[i - 1] + (y[i] - y[i - 1]) * (e - x[i - 1]) / (x[i] - x[i - 1]);
+
+        return interpolation == LOG_LOG_INTERPOLATION ? std::exp(v) : v;
+    };
+
+    G4double operator()(G4double energy) const {
+        return GetValue(energy);
+    };
+
+    size_t GetSize() const {
+        return this->energies.size();
+    };
+
+    Interpolation GetInterpolation() const {
+        return this->interpolation;
+    };
+
+  private:
+    Interpolation interpolation;
+
+    std::vector<G4double> energies;
+    std::vector<G4double> values;
+
+    // Points in the interpolation space, i.e. logarithms for LOG_LOG
+    std::vector<G4double> x;
+    std::vector<G4double> y;
+};
+
+#endif // G4VOXELCOEFFICIENTTABLE_H
+
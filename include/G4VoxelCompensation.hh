@@ -0,0 +1,69 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELCOMPENSATION_H
+#define G4VOXELCOMPENSATION_H
+
+// STL //
+#include <cmath>
+#include <cstddef>
+
+
+// Compensated (Neumaier) summation: `sum += value`, with the low order
+// bits lost to rounding collected in `compensation`, so that
+// sum + compensation is accurate to about the precision of T squared
+// however many values are added. Lets float32 sums match double.
+template <typename T>
+inline void G4VoxelCompensatedAdd(T& sum, T& compensation, T value) {
+    T total = sum + value;
+
+    if (std::abs(sum) >= std::abs(value)) {
+        compensation += (sum - total) + value;
+    } else {
+        compensation += (value - total) + sum;
+    }
+
+    sum = total;
+}
+
+// Merge the sums in channel 0 of the records `stride` apart lying wholly in
+// [begin, end) of `in` into `out`, carrying the rounding error into channel
+// `compensation`, so that nothing outside the range is written. Channel 0
+// of `in` is zeroed, the other channels are left for a plain merge.
+template <typename T>
+inline void G4VoxelMergeCompensated(T* out, T* in, size_t begin, size_t end,
+                                    unsigned int stride, unsigned int compensation) {
+    // First record starting in the range
+    for (size_t r=(begin + stride - 1)/stride*stride; r + stride <= end; r+=stride) {
+        G4VoxelCompensatedAdd(out[r], out[r + compensation], in[r]);
+        in[r] = 0;
+    }
+}
+
+#endif // G4VOXELCOMPENSATION_H
+
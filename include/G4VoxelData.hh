@@ -93,6 +93,10 @@ class G4VoxelData {
         this->length = 1;
         for (unsigned int i=0; i<this->ndims; i++) this->length *= this->shape[i];
 
+        this->origin.assign(this->ndims, 0);
+        this->type = UNKNOWN;
+        this->order = ROW_MAJOR;
+
         this->array = new std::vector<char>;
         this->array->assign(this->length*size, 0);
     }
@@ -32,24 +32,50 @@
 // G4VOXELDATA //
 #include "G4VoxelData.hh"
 #include "G4VoxelDataLogger.hh"
+#include "G4VoxelDataIOStats.hh"
+
+// STL //
+#include <vector>
+#include <string>
+#include <istream>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <future>
+#include <functional>
 
 // GEANT4 //
 #include "globals.hh"
 
 
 class G4VoxelDataIO {
+  public:
+    typedef std::function<void(G4VoxelData*)> ReadCallback;
+
+    // How sure a reader is that it can handle a path, as returned by the
+    // static `Sniff` of each reader, see G4VoxelDataIORegistry.
+    enum SniffResult {
+        SNIFF_NONE = 0,
+        SNIFF_EXTENSION = 1,
+        SNIFF_CONTENT = 2
+    };
+
   public:
     G4VoxelDataIO() {
         this->verbose = false;
         this->logger = new G4VoxelDataLogger(ERROR);
+        this->header = NULL;
     };
     
     G4VoxelDataIO(G4bool verbose) {
         this->verbose = verbose;
         this->logger = new G4VoxelDataLogger(ERROR);
+        this->header = NULL;
     };
     
-    ~G4VoxelDataIO() {};
+    virtual ~G4VoxelDataIO() {
+        delete logger;
+    };
 
   public:
     virtual G4VoxelData* Read(G4String) {
@@ -64,6 +90,165 @@ class G4VoxelDataIO {
                 FatalException, "");
     };
 
+    // Run `Read` on a background thread. Call `get()` on the returned
+    // future where the data is actually needed, it blocks only if the read
+    // has not finished yet. The reader must not be reconfigured or used for
+    // another read until the future is ready.
+    std::shared_future<G4VoxelData*> ReadAsync(G4String filename) {
+        return std::async(std::launch::async,
+                          &G4VoxelDataIO::Read, this, filename).share();
+    };
+
+    // As above, `callback` is invoked on the background thread once the
+    // data has been read.
+    std::shared_future<G4VoxelData*> ReadAsync(G4String filename,
+                                               ReadCallback callback) {
+        return std::async(std::launch::async, [this, filename, callback]() {
+            G4VoxelData* data = this->Read(filename);
+            callback(data);
+            return data;
+        }).share();
+    };
+
+    // Streaming access for volumes that do not fit in memory.
+    // `ReadHeader` describes the whole volume without reading any voxels
+    // (the returned array is NULL) and prepares the reader for subsequent
+    // `ReadChunk` or `ReadSlab` calls on the same file.
+    virtual G4VoxelData* ReadHeader(G4String) {
+        G4Exception("G4VoxelData::ReadHeader", "Streaming data not implemented.",
+                FatalException, "");
+
+        return NULL;
+    };
+
+    // Read the box of voxels starting at `offset` with extent `shape`. The
+    // chunk keeps the data type and spacing of the volume, its origin is
+    // the centre of the box in the frame of the volume.
+    virtual G4VoxelData* ReadChunk(std::vector<unsigned int>,
+                                   std::vector<unsigned int>) {
+        G4Exception("G4VoxelData::ReadChunk", "Streaming data not implemented.",
+                FatalException, "");
+
+        return NULL;
+    };
+
+    // Read the whole of the z-slices [zmin, zmax).
+    virtual G4VoxelData* ReadSlab(unsigned int zmin, unsigned int zmax) {
+        if (!header) {
+            logger->error << "ReadSlab: No file was opened with ReadHeader." << std::endl;
+            return NULL;
+        }
+
+        std::vector<unsigned int> offset(3, 0);
+        offset[2] = zmin;
+
+        std::vector<unsigned int> shape(header->shape.begin(), header->shape.begin() + 3);
+        shape[2] = zmax - zmin;
+
+        return ReadChunk(offset, shape);
+    };
+
+    G4VoxelData* GetHeader() {
+        return this->header;
+    };
+
+    // Select the array to read from files that hold several, i.e. the
+    // datasets of an HDF5 file or the members of an npz archive. Readers of
+    // single arrays ignore it.
+    virtual void SetArrayName(G4String) {};
+
+  protected:
+    // Compare the bytes at `offset` in `filename` against `magic`.
+    static G4bool HasMagic(G4String filename, std::streamoff offset,
+                           std::string magic) {
+        std::ifstream file(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+        std::string bytes(magic.size(), '\0');
+
+        file.seekg(offset);
+        file.read(&bytes[0], bytes.size());
+
+        return file.good() && bytes == magic;
+    };
+
+    // Case insensitive match of the end of `filename`, e.g. ".npy".
+    static G4bool HasExtension(G4String filename, std::string extension) {
+        if (filename.size() < extension.size()) return false;
+
+        std::string end = filename.substr(filename.size() - extension.size());
+        std::transform(end.begin(), end.end(), end.begin(), ::tolower);
+
+        return end == extension;
+    };
+
+    // Wrap `buffer` as a chunk of the volume described by `header`.
+    G4VoxelData* MakeChunk(std::vector<char>* buffer,
+                           std::vector<unsigned int> offset,
+                           std::vector<unsigned int> shape) {
+        unsigned int length = 1;
+        std::vector<double> origin(header->origin);
+
+        for (unsigned int i=0; i<shape.size(); i++) {
+            length *= shape[i];
+            origin[i] += (offset[i] + shape[i]/2. - header->shape[i]/2.)
+                       * header->spacing[i];
+        }
+
+        return new G4VoxelData(buffer, length, shape.size(), shape,
+                               header->spacing, origin, header->type, header->order);
+    };
+
+    // Read a chunk of a flat, x-fastest array of `word_size` byte elements
+    // that starts `data_offset` bytes into `stream`. Runs of voxels that are
+    // contiguous on disk are read with a single call. NULL, with the error
+    // logged, if the file ends before the chunk.
+    std::vector<char>* ReadRawChunk(std::istream& stream, std::streamoff data_offset,
+                                    unsigned int word_size,
+                                    std::vector<unsigned int> offset,
+                                    std::vector<unsigned int> shape) {
+        std::vector<unsigned int>& full = header->shape;
+
+        // Extend the contiguous run along y and z while the chunk covers
+        // the full extent of the faster axes.
+        std::streamsize run = shape[0];
+        unsigned int ny = shape[1];
+        unsigned int nz = shape[2];
+        if (shape[0] == full[0]) {
+            run *= shape[1];
+            ny = 1;
+            if (shape[1] == full[1]) {
+                run *= shape[2];
+                nz = 1;
+            }
+        }
+        run *= word_size;
+
+        std::vector<char>* buffer =
+            new std::vector<char>((size_t) shape[0]*shape[1]*shape[2]*word_size);
+        char* out = &buffer->front();
+
+        for (unsigned int z=0; z<nz; z++) {
+            for (unsigned int y=0; y<ny; y++) {
+                std::streamoff index = offset[0]
+                    + (std::streamoff) full[0]*(offset[1] + y)
+                    + (std::streamoff) full[0]*full[1]*(offset[2] + z);
+
+                stream.seekg(data_offset + index*word_size);
+                stream.read(out, run);
+                out += run;
+
+                if (!stream || stream.gcount() != run) {
+                    logger->error << "Cannot read " << run << " bytes at "
+                                  << data_offset + index*word_size << std::endl;
+                    stream.clear();
+                    delete buffer;
+                    return NULL;
+                }
+            }
+        }
+
+        return buffer;
+    };
+
   public:
     void SetVerbose(G4bool verbose) {
         this->logger->SetVerbose(verbose);
@@ -73,9 +258,23 @@ class G4VoxelDataIO {
         return this->logger->GetVerbose();
     };
 
+    // Timings and byte counts accumulated over all reads by this reader.
+    G4VoxelDataIOStats* GetStats() {
+        return &this->stats;
+    };
+
+    void ReportStats() {
+        this->stats.Print(this->logger->message);
+    };
+
   public:
     G4bool verbose;
     G4VoxelDataLogger* logger;
+
+    // Volume opened by the last call to `ReadHeader`, NULL if it failed
+    G4VoxelData* header;
+
+    G4VoxelDataIOStats stats;
 };
 
 #endif // G4VOXELDATAIO_H
@@ -0,0 +1,171 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELDATAIOREGISTRY_H
+#define G4VOXELDATAIOREGISTRY_H
+
+// G4VOXELDATA //
+#include "G4VoxelData.hh"
+#include "G4VoxelDataIO.hh"
+#include "G4VoxelDataLogger.hh"
+
+// STL //
+#include <vector>
+
+// GEANT4 //
+#include "globals.hh"
+#include "G4AutoLock.hh"
+
+
+// Chooses a reader for a path by asking every registered reader to sniff
+// it. Readers are only registered by the application, so that only the
+// libraries actually linked are required:
+//
+//     G4VoxelDataIORegistry* registry = G4VoxelDataIORegistry::GetInstance();
+//     registry->Register<DicomDataIO>("DICOM");
+//     registry->Register<NumpyDataIO>("NUMPY");
+//
+//     G4VoxelData* data = registry->Read(path);
+//
+// A reader class provides a default constructor and the static functions
+// `G4int Sniff(G4String)`, returning a `G4VoxelDataIO::SniffResult`, and
+// `G4bool IsDirect()`, true when it reads straight into the voxel buffer.
+// A content match beats an extension match, direct readers win ties and
+// otherwise the first registered reader is chosen.
+class G4VoxelDataIORegistry {
+  public:
+    typedef G4int (*SniffFunction)(G4String);
+    typedef G4bool (*DirectFunction)();
+    typedef G4VoxelDataIO* (*CreateFunction)();
+
+    struct Entry {
+        G4String name;
+        SniffFunction sniff;
+        DirectFunction direct;
+        CreateFunction create;
+    };
+
+  public:
+    static G4VoxelDataIORegistry* GetInstance() {
+        static G4VoxelDataIORegistry registry;
+        return &registry;
+    };
+
+    template <typename IO>
+    void Register(G4String name) {
+        Entry entry;
+        entry.name = name;
+        entry.sniff = &IO::Sniff;
+        entry.direct = &IO::IsDirect;
+        entry.create = &Create<IO>;
+
+        // Readers may be registered and used from several threads.
+        G4AutoLock lock(GetMutex());
+        entries.push_back(entry);
+    };
+
+    // Name of the best reader for `path`, or an empty string.
+    G4String Identify(G4String path) {
+        Entry entry;
+        return Find(path, entry) ? entry.name : G4String("");
+    };
+
+    // A new instance of the best reader for `path`, or NULL.
+    G4VoxelDataIO* GetReader(G4String path) {
+        Entry entry;
+        if (!Find(path, entry)) {
+            logger->error << "G4VoxelDataIORegistry: No reader for " << path << std::endl;
+            return NULL;
+        }
+
+        logger->message << "G4VoxelDataIORegistry: Reading " << path
+                        << " as " << entry.name << std::endl;
+        return entry.create();
+    };
+
+    G4VoxelData* Read(G4String path) {
+        G4VoxelDataIO* reader = GetReader(path);
+        if (!reader) return NULL;
+
+        G4VoxelData* data = reader->Read(path);
+        delete reader;
+
+        return data;
+    };
+
+    std::vector<Entry> GetEntries() {
+        G4AutoLock lock(GetMutex());
+        return this->entries;
+    };
+
+    void SetVerbose(G4bool verbose) {
+        this->logger->SetVerbose(verbose);
+    };
+
+  private:
+    G4VoxelDataIORegistry() {
+        this->logger = new G4VoxelDataLogger(ERROR);
+    };
+
+    template <typename IO>
+    static G4VoxelDataIO* Create() {
+        return new IO();
+    };
+
+    // Copy the best entry for `path` into `best`, false if there is none.
+    G4bool Find(G4String path, Entry& best) {
+        std::vector<Entry> candidates = GetEntries();
+        G4int best_rank = 0;
+
+        for (unsigned int i=0; i<candidates.size(); i++) {
+            G4int score = candidates[i].sniff(path);
+            if (score == G4VoxelDataIO::SNIFF_NONE) continue;
+
+            G4int rank = 2*score + (candidates[i].direct() ? 1 : 0);
+            if (rank > best_rank) {
+                best = candidates[i];
+                best_rank = rank;
+            }
+        }
+
+        return best_rank > 0;
+    };
+
+    // Function local, so that the header needs no out of line definition.
+    static G4Mutex* GetMutex() {
+        static G4Mutex mutex = G4MUTEX_INITIALIZER;
+        return &mutex;
+    };
+
+  private:
+    std::vector<Entry> entries;
+    G4VoxelDataLogger* logger;
+};
+
+#endif // G4VOXELDATAIOREGISTRY_H
+
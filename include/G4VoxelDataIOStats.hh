@@ -0,0 +1,272 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELDATAIOSTATS_H
+#define G4VOXELDATAIOSTATS_H
+
+// STL //
+#include <map>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+#include <istream>
+#include <iomanip>
+
+// GEANT4 //
+#include "globals.hh"
+#include "G4AutoLock.hh"
+
+
+// Counters and per-phase wall times collected by the readers, so that the
+// time spent loading a volume can be attributed to scanning, reading,
+// decoding, rescaling, copying and so on. Phases are free-form names and
+// are reported in the order they were first seen. Statistics from several
+// readers or jobs can be combined with `Merge`, or written with `Write`
+// and read back with `Read` for aggregation elsewhere.
+class G4VoxelDataIOStats {
+  public:
+    struct Phase {
+        Phase() : calls(0), seconds(0), bytes(0) {};
+
+        unsigned long calls;
+        G4double seconds;
+        unsigned long long bytes;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    // Accumulates the time from construction to `Stop` (or destruction)
+    // into a phase of `stats`.
+    class Timer {
+      public:
+        Timer(G4VoxelDataIOStats* stats, std::string phase) {
+            this->stats = stats;
+            this->phase = phase;
+            this->start = Clock::now();
+            this->stopped = false;
+        };
+
+        ~Timer() {
+            Stop();
+        };
+
+        void Stop(unsigned long long bytes=0) {
+            if (stopped) return;
+
+            std::chrono::duration<G4double> elapsed = Clock::now() - start;
+            stats->AddPhase(phase, elapsed.count(), bytes);
+            stopped = true;
+        };
+
+      private:
+        G4VoxelDataIOStats* stats;
+        std::string phase;
+        Clock::time_point start;
+        G4bool stopped;
+    };
+
+  public:
+    G4VoxelDataIOStats() {
+        Reset();
+    };
+
+    G4VoxelDataIOStats(const G4VoxelDataIOStats& other) {
+        *this = other;
+    };
+
+    G4VoxelDataIOStats& operator=(const G4VoxelDataIOStats& other) {
+        if (this != &other) {
+            G4AutoLock lock(&mutex);
+            this->files_scanned = other.files_scanned;
+            this->bytes_read = other.bytes_read;
+            this->bytes_decoded = other.bytes_decoded;
+            this->phases = other.phases;
+            this->phase_order = other.phase_order;
+        }
+        return *this;
+    };
+
+    void Reset() {
+        G4AutoLock lock(&mutex);
+        files_scanned = 0;
+        bytes_read = 0;
+        bytes_decoded = 0;
+        phases.clear();
+        phase_order.clear();
+    };
+
+    void AddPhase(std::string name, G4double seconds, unsigned long long bytes=0,
+                  unsigned long calls=1) {
+        G4AutoLock lock(&mutex);
+        if (phases.find(name) == phases.end()) {
+            phase_order.push_back(name);
+        }
+
+        Phase& phase = phases[name];
+        phase.calls += calls;
+        phase.seconds += seconds;
+        phase.bytes += bytes;
+    };
+
+    void AddFilesScanned(unsigned long files) {
+        G4AutoLock lock(&mutex);
+        files_scanned += files;
+    };
+
+    void AddBytesRead(unsigned long long bytes) {
+        G4AutoLock lock(&mutex);
+        bytes_read += bytes;
+    };
+
+    void AddBytesDecoded(unsigned long long bytes) {
+        G4AutoLock lock(&mutex);
+        bytes_decoded += bytes;
+    };
+
+    void Merge(const G4VoxelDataIOStats& other) {
+        G4VoxelDataIOStats copy(other);
+
+        for (unsigned int i=0; i<copy.phase_order.size(); i++) {
+            Phase& phase = copy.phases[copy.phase_order[i]];
+            AddPhase(copy.phase_order[i], phase.seconds, phase.bytes, phase.calls);
+        }
+
+        AddFilesScanned(copy.files_scanned);
+        AddBytesRead(copy.bytes_read);
+        AddBytesDecoded(copy.bytes_decoded);
+    };
+
+    unsigned long GetFilesScanned() {
+        return this->files_scanned;
+    };
+
+    unsigned long long GetBytesRead() {
+        return this->bytes_read;
+    };
+
+    unsigned long long GetBytesDecoded() {
+        return this->bytes_decoded;
+    };
+
+    std::vector<std::string> GetPhaseNames() {
+        G4AutoLock lock(&mutex);
+        return this->phase_order;
+    };
+
+    Phase GetPhase(std::string name) {
+        G4AutoLock lock(&mutex);
+        if (phases.find(name) == phases.end()) return Phase();
+        return phases[name];
+    };
+
+    G4double GetTotalSeconds() {
+        G4AutoLock lock(&mutex);
+        G4double seconds = 0;
+        for (unsigned int i=0; i<phase_order.size(); i++) {
+            seconds += phases[phase_order[i]].seconds;
+        }
+        return seconds;
+    };
+
+    // Throughput of a phase in MB/s, zero if it moved no bytes.
+    G4double GetThroughput(std::string name) {
+        Phase phase = GetPhase(name);
+        if (phase.seconds <= 0) return 0;
+        return phase.bytes / phase.seconds / 1e6;
+    };
+
+    // Human readable summary, e.g. `stats.Print(logger->message)`.
+    void Print(std::ostream& out) {
+        out << "Files scanned: " << GetFilesScanned()
+            << ", read: " << GetBytesRead()/1e6 << " MB"
+            << ", decoded: " << GetBytesDecoded()/1e6 << " MB"
+            << ", total: " << GetTotalSeconds() << " s" << std::endl;
+
+        std::vector<std::string> names = GetPhaseNames();
+        for (unsigned int i=0; i<names.size(); i++) {
+            Phase phase = GetPhase(names[i]);
+            out << "  " << std::left << std::setw(10) << names[i] << std::right
+                << std::setw(8) << phase.calls << " calls "
+                << std::setw(10) << phase.seconds << " s ";
+            if (phase.bytes > 0) {
+                out << std::setw(10) << phase.bytes/1e6 << " MB "
+                    << std::setw(10) << GetThroughput(names[i]) << " MB/s";
+            }
+            out << std::endl;
+        }
+    };
+
+    // One record per line, `files|read|decoded <value>` or
+    // `phase <name> <calls> <seconds> <bytes>`.
+    void Write(std::ostream& out) {
+        out << "files " << GetFilesScanned() << std::endl;
+        out << "read " << GetBytesRead() << std::endl;
+        out << "decoded " << GetBytesDecoded() << std::endl;
+
+        std::vector<std::string> names = GetPhaseNames();
+        for (unsigned int i=0; i<names.size(); i++) {
+            Phase phase = GetPhase(names[i]);
+            out << "phase " << names[i] << " " << phase.calls << " "
+                << std::setprecision(17) << phase.seconds << " "
+                << phase.bytes << std::endl;
+        }
+    };
+
+    // Add the records written by `Write` to these statistics.
+    void Read(std::istream& in) {
+        std::string record;
+        while (in >> record) {
+            if (record == "phase") {
+                std::string name;
+                Phase phase;
+                in >> name >> phase.calls >> phase.seconds >> phase.bytes;
+                AddPhase(name, phase.seconds, phase.bytes, phase.calls);
+            } else {
+                unsigned long long value;
+                in >> value;
+                if (record == "files") AddFilesScanned(value);
+                if (record == "read") AddBytesRead(value);
+                if (record == "decoded") AddBytesDecoded(value);
+            }
+        }
+    };
+
+  private:
+    unsigned long files_scanned;
+    unsigned long long bytes_read;
+    unsigned long long bytes_decoded;
+
+    std::map<std::string, Phase> phases;
+    std::vector<std::string> phase_order;
+
+    G4Mutex mutex;
+};
+
+#endif // G4VOXELDATAIOSTATS_H
+
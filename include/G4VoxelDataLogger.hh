@@ -68,7 +68,7 @@ class LoggerStream : public std::ostream {
         };
 
         int sync() {
-            if (this->active == true) {
+            if (this->active == true && !str().empty()) {
                 std::cout << name << buffer << str();
             }
             str("");
@@ -35,6 +35,7 @@
 // STL //
 #include <vector>
 #include <map>
+#include <climits>
 
 // GEANT4 //
 #include "globals.hh"
@@ -283,10 +284,128 @@ public:
         box.SetZHalfLength(voxel_size.z());
     };
 
+    // Density of the material of each placed voxel, after cropping and
+    // merging, looked up as `ComputeMaterial` does. The array has the shape
+    // and spacing of the placed voxels, x fastest, as scored by a
+    // G4VoxelDetector with replica indexing.
+    G4VoxelArray<double>* GetDensityArray() {
+        std::vector<unsigned int> placed = array->GetShape();
+        std::vector<unsigned int> merge = array->GetMergeSize();
+        std::vector<unsigned int> limits = array->GetCropLimit();
+
+        G4VoxelArray<double>* density = new G4VoxelArray<double>(placed, array->GetSpacing());
+        std::vector<double>& out = *density->array;
+
+        size_t index = 0;
+        for (unsigned int z=0; z<placed[2]; z++) {
+            for (unsigned int y=0; y<placed[1]; y++) {
+                for (unsigned int x=0; x<placed[0]; x++) {
+                    G4Material* material = GetMaterial(x*merge[0] + limits[0],
+                                                       y*merge[1] + limits[2],
+                                                       z*merge[2] + limits[4]);
+                    out[index++] = material->GetDensity();
+                }
+            }
+        }
+
+        return density;
+    };
+
+    // Mass of each placed voxel, see `GetDensityArray`.
+    G4VoxelArray<double>* GetMassArray() {
+        G4VoxelArray<double>* mass = GetDensityArray();
+        G4ThreeVector half = array->GetVoxelSize();
+        G4double volume = 8 * half.x() * half.y() * half.z();
+
+        std::vector<double>& values = *mass->array;
+        for (size_t i=0; i<values.size(); i++) {
+            values[i] *= volume;
+        }
+
+        return mass;
+    };
+
+    // Material of each placed voxel, see `GetDensityArray`, as an index
+    // into `materials`, which gets every distinct material in order of
+    // first appearance.
+    G4VoxelArray<unsigned short>* GetMaterialIndexArray(std::vector<G4Material*>& materials) {
+        std::vector<unsigned int> placed = array->GetShape();
+        std::vector<unsigned int> merge = array->GetMergeSize();
+        std::vector<unsigned int> limits = array->GetCropLimit();
+
+        G4VoxelArray<unsigned short>* indices =
+            new G4VoxelArray<unsigned short>(placed, array->GetSpacing());
+        std::vector<unsigned short>& out = *indices->array;
+
+        std::map<G4Material*, unsigned short> found;
+        for (unsigned int i=0; i<materials.size(); i++) {
+            found[materials[i]] = i;
+        }
+
+        size_t index = 0;
+        for (unsigned int z=0; z<placed[2]; z++) {
+            for (unsigned int y=0; y<placed[1]; y++) {
+                for (unsigned int x=0; x<placed[0]; x++) {
+                    G4Material* material = GetMaterial(x*merge[0] + limits[0],
+                                                       y*merge[1] + limits[2],
+                                                       z*merge[2] + limits[4]);
+
+                    std::map<G4Material*, unsigned short>::iterator it =
+                        found.find(material);
+                    if (it == found.end()) {
+                        if (materials.size() > USHRT_MAX) {
+                            G4Exception("G4VoxelDataParameterisation::GetMaterialIndexArray",
+                                    "TooManyMaterials", FatalException,
+                                    "More distinct materials than an index can hold.");
+                        }
+                        it = found.insert(std::make_pair(material,
+                                    (unsigned short) materials.size())).first;
+                        materials.push_back(material);
+                    }
+                    out[index++] = it->second;
+                }
+            }
+        }
+
+        return indices;
+    };
+
     G4LogicalVolume* GetLogicalVolume() {
         return voxel_logical;
     };
 
+    // The box holding the voxels, placed in the mother by `Construct`.
+    G4LogicalVolume* GetContainerLogicalVolume() {
+        return voxeldata_logical;
+    };
+
+    // Whether the volume of `touchable` is one of the placed voxels.
+    G4bool IsVoxel(const G4VTouchable* touchable) const {
+        return touchable && touchable->GetVolume() &&
+               touchable->GetVolume()->GetLogicalVolume() == voxel_logical;
+    };
+
+    // Index (x fastest) of the voxel of `touchable` in an array over the
+    // placed voxels, i.e. of the shape of the G4VoxelArray after cropping
+    // and merging. Straight from the replica numbers, as REPLICA_INDEXING
+    // in G4VoxelDetector: the copy number is z, the replica numbers of the
+    // x and y mothers are x and y.
+    size_t GetPlacedIndex(const G4VTouchable* touchable) const {
+        size_t x = touchable->GetReplicaNumber(1);
+        size_t y = touchable->GetReplicaNumber(2);
+        size_t z = touchable->GetReplicaNumber(0);
+
+        return x + shape[0]*(y + shape[1]*z);
+    };
+
+    std::vector<unsigned int> GetPlacedShape() const {
+        return shape;
+    };
+
+    std::vector<double> GetPlacedSpacing() const {
+        return spacing;
+    };
+
     void SetVisibility(G4bool visibility) {
         this->visibility = visibility;
     };
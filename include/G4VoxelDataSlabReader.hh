@@ -0,0 +1,186 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELDATASLABREADER_H
+#define G4VOXELDATASLABREADER_H
+
+// G4VOXELDATA //
+#include "G4VoxelData.hh"
+#include "G4VoxelDataIO.hh"
+#include "G4VoxelDataStore.hh"
+
+// STL //
+#include <vector>
+#include <future>
+#include <algorithm>
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// Walks a volume in successive chunks through the streaming interface of
+// a `G4VoxelDataIO`, so that volumes larger than memory can be processed.
+// While the current chunk is being worked on the next one is already read
+// on a background thread, so at most two chunks are held at once:
+//
+//     NumpyDataIO io;
+//     G4VoxelDataSlabReader slabs(&io, "ct.npy", 16);
+//     while (slabs.HasNext()) {
+//         G4VoxelData* slab = slabs.Next();
+//         ...
+//     }
+//
+// Chunks are owned by the slab reader and are valid until the next call to
+// `Next`. The IO must not be used directly while the slab reader is active.
+// If the file cannot be read the error is logged, `GetHeader` is NULL and
+// `HasNext` false; `Next` returns NULL for a chunk that cannot be read.
+class G4VoxelDataSlabReader {
+  public:
+    // Whole z-slabs, `thickness` slices at a time.
+    G4VoxelDataSlabReader(G4VoxelDataIO* io, G4String filename,
+                          unsigned int thickness) {
+        Init(io, filename);
+
+        if (header) {
+            chunk_shape.assign(header->shape.begin(), header->shape.begin() + 3);
+            chunk_shape[2] = thickness;
+        }
+
+        Prefetch();
+    };
+
+    // Boxes of `chunk_shape`, iterated with x fastest. Boxes at the upper
+    // edges of the volume are truncated.
+    G4VoxelDataSlabReader(G4VoxelDataIO* io, G4String filename,
+                          std::vector<unsigned int> chunk_shape) {
+        Init(io, filename);
+
+        this->chunk_shape = chunk_shape;
+
+        Prefetch();
+    };
+
+    ~G4VoxelDataSlabReader() {
+        Release(current);
+        if (pending.valid()) {
+            Release(pending.get());
+        }
+    };
+
+    G4VoxelData* GetHeader() {
+        return this->header;
+    };
+
+    G4bool HasNext() {
+        return pending.valid();
+    };
+
+    G4VoxelData* Next() {
+        Release(current);
+
+        current = pending.get();
+        current_offset = pending_offset;
+
+        Prefetch();
+
+        return current;
+    };
+
+    // Position of the chunk returned by the last call to `Next`.
+    std::vector<unsigned int> GetOffset() {
+        return this->current_offset;
+    };
+
+  private:
+    void Init(G4VoxelDataIO* io, G4String filename) {
+        this->io = io;
+        this->header = io->ReadHeader(filename);
+        this->current = NULL;
+
+        this->next_offset.assign(3, 0);
+
+        if (!header) {
+            io->logger->error << "G4VoxelDataSlabReader: Cannot read " << filename
+                              << std::endl;
+        }
+    };
+
+    void Prefetch() {
+        if (!header) {
+            pending = std::future<G4VoxelData*>();
+            return;
+        }
+
+        std::vector<unsigned int>& full = header->shape;
+
+        if (next_offset[2] >= full[2]) {
+            pending = std::future<G4VoxelData*>();
+            return;
+        }
+
+        std::vector<unsigned int> shape(3);
+        for (unsigned int i=0; i<3; i++) {
+            shape[i] = std::min(chunk_shape[i], full[i] - next_offset[i]);
+        }
+
+        pending = std::async(std::launch::async, &G4VoxelDataIO::ReadChunk,
+                             io, next_offset, shape);
+        pending_offset = next_offset;
+
+        // Advance x, then y, then z.
+        for (unsigned int i=0; i<3; i++) {
+            next_offset[i] += chunk_shape[i];
+            if (next_offset[i] < full[i] || i == 2) break;
+            next_offset[i] = 0;
+        }
+    };
+
+    // Chunks are registered for garbage collection like all G4VoxelData,
+    // take them back so memory stays bounded while streaming.
+    void Release(G4VoxelData* data) {
+        if (data) {
+            G4VoxelDataStore<G4VoxelData*>::DeRegister(data);
+            delete data;
+        }
+    };
+
+  private:
+    G4VoxelDataIO* io;
+    G4VoxelData* header;
+    std::vector<unsigned int> chunk_shape;
+
+    G4VoxelData* current;
+    std::vector<unsigned int> current_offset;
+
+    std::future<G4VoxelData*> pending;
+    std::vector<unsigned int> pending_offset;
+    std::vector<unsigned int> next_offset;
+};
+
+#endif // G4VOXELDATASLABREADER_H
+
@@ -31,9 +31,11 @@
 
 // STL //
 #include <vector>
+#include <algorithm>
 
 // GEANT4 //
 #include "globals.hh"
+#include "G4AutoLock.hh"
 
 template <typename T>
 class G4VoxelDataStore : public std::vector<T>
@@ -56,19 +58,23 @@ class G4VoxelDataStore : public std::vector<T>
     
     static void Register(T voxel_data)
     {
+        // Readers may construct data on background threads.
+        G4AutoLock lock(&mutex);
         GetInstance()->push_back(voxel_data);
     };
 
-    static void DeRegister(T)
+    // Remove `voxel_data` from the store without deleting it, the caller
+    // takes over ownership.
+    static void DeRegister(T voxel_data)
     {
         if (!locked) {
+            G4AutoLock lock(&mutex);
             G4VoxelDataStore* store = GetInstance();
             
-            for (typename std::vector<T>::iterator current=store->begin(); current!=store->end(); current++) {
-                //if (**current == *voxel_data) {
-                //    store->erase(current);
-                //    break;
-                //}
+            typename std::vector<T>::iterator current =
+                std::find(store->begin(), store->end(), voxel_data);
+            if (current != store->end()) {
+                store->erase(current);
             }
         }
     };
@@ -101,10 +107,12 @@ class G4VoxelDataStore : public std::vector<T>
   private:
     static G4VoxelDataStore<T>* instance;
     static bool locked;
+    static G4Mutex mutex;
 };
 
 template <typename T> G4VoxelDataStore<T>* G4VoxelDataStore<T>::instance = 0;
 template <typename T> bool G4VoxelDataStore<T>::locked = 0;
+template <typename T> G4Mutex G4VoxelDataStore<T>::mutex = G4MUTEX_INITIALIZER;
 
 #endif // G4VOXELDATASTORE_H
 
@@ -32,14 +32,40 @@
 // G4VoxelData //
 #include "G4VoxelData.hh"
 #include "G4VoxelArray.hh"
+#include "G4VoxelRecordArray.hh"
+#include "G4VoxelSparseRecordArray.hh"
+#include "G4VoxelMappedRecordArray.hh"
+#include "G4VoxelAtomic.hh"
+#include "G4VoxelFixedPoint.hh"
+#include "G4VoxelScoringGrid.hh"
+#include "G4VoxelCoefficientTable.hh"
+#include "G4VoxelScorers.hh"
+#include "G4VoxelBinning.hh"
+#include "G4VoxelSnapshotWriter.hh"
+#include "G4VoxelWorkerThread.hh"
 
 // STL //
 #include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
 
 // GEANT4 //
 #include "G4VSensitiveDetector.hh"
 #include "G4SDManager.hh"
 #include "G4VUserDetectorConstruction.hh"
+#include "G4Threading.hh"
+#include "G4AutoLock.hh"
+#include "G4RunManager.hh"
+#include "Randomize.hh"
 #include "globals.hh"
 
 
@@ -49,11 +75,181 @@ class G4HCofThisEvent;
 class DetectorConstruction;
 
 
-template <typename T>
+// Scoring records
+// ===============
+// The total energy, sum of squared energy and total weight of each voxel
+// are kept together in a single record, along with any extra user channels,
+// so that a hit costs one index computation and touches one cache line. The
+// records are dense (G4VoxelRecordArray) by default; for large, sparsely
+// hit grids use `G4VoxelDetector<T, G4VoxelSparseRecordArray<T> >`, which
+// only allocates the 8x8x8 bricks of voxels that are actually hit.
+// `PrintAll` reports the memory used. `GetEnergyHistogram` and friends copy
+// a channel out into a G4VoxelArray view owned by the detector, which is a
+// snapshot and only refreshed by calling the getter again.
+//
+// Multithreading
+// ==============
+// Under G4MTRunManager or G4TaskRunManager every worker thread constructs its
+// own sensitive detector in `ConstructSDandField`, so each worker fills its
+// own private records without any locking. Build one detector on the
+// master in `Construct` and hand it to each worker detector with
+// `SetMaster`, then call `Reduce` on the master detector at the end of the
+// run (from the master's `G4UserRunAction::EndOfRunAction`, which runs once
+// all workers have finished) to sum and clear the worker histograms.
+//
+// Memory: every detector holds N = shape[0]*shape[1]*shape[2] records of S
+// values of T, S being the number of channels (3 plus any extra, rounded up
+// to a power of two with `SetRecordPadding`). With W workers scoring takes
+// S*(W + 1)*N*sizeof(T) bytes, e.g. 8 threads scoring 512x512x256 voxels in
+// double take 13.5 GiB.
+//
+// The reduction adds the workers into the master in order of thread id,
+// voxel by voxel, independently of how the voxels are split between the
+// reducing threads, so for a fixed thread count it is bitwise reproducible
+// given the same worker histograms. Worker histograms are themselves only
+// reproducible if the events are handed to the workers in a fixed order
+// (e.g. `G4MTRunManager::SetEventModulo` with a fixed seed).
+//
+// For large grids or many threads the per-thread copies can be avoided by
+// constructing the master with ATOMIC_ACCUMULATION: worker detectors then
+// share the master histograms and update them with lock-free atomic adds
+// (a compare-and-swap loop for floating point T, a native fetch-add for
+// integer T). Scoring then takes S*N*sizeof(T) bytes whatever the thread
+// count, at the cost of contention on hot voxels, and there is nothing to
+// `Reduce`. Floating point sums are accumulated in whatever order the
+// threads get there, so are not reproducible.
+//
+// Scoring into G4VoxelFixedPoint (see G4VoxelFixedPoint.hh) makes the sums
+// exact and independent of the order of accumulation, so results are the
+// same for any thread count and either accumulation mode.
+enum Accumulation {
+    LOCAL_ACCUMULATION,
+    ATOMIC_ACCUMULATION
+};
+
+
+// Indexing
+// ========
+// By default the voxel of a hit is found from its position in the local
+// frame of the touchable, assuming the grid is centred there. When the
+// detector is attached to the voxel logical volume of a
+// G4VoxelDataParameterisation, REPLICA_INDEXING takes the indices straight
+// from the touchable instead: the copy number of the parameterised voxel
+// is z, and the replica numbers of its x and y mothers are x and y. This
+// avoids the transform and the division, and never bins a hit on the edge
+// of a voxel into its neighbour.
+//
+// Replica indices address the placed grid, i.e. after any cropping and
+// merging of the G4VoxelArray. Either score on that grid (shape from
+// `GetVolumeShape`), or call `SetReplicaIndexing(array)` to score in the
+// frame of the full array as the parameterisation looks up materials:
+// index = crop offset + replica * merge size.
+//
+// The scoring grid need not match the geometry. `SetOrigin` moves the
+// centre of the grid in its frame, which is the local frame of the
+// touchable by default or that of one of its mothers with `SetGridDepth`.
+// With `SetStepSplitting(true)` the deposit of a step is shared among the
+// voxels the step crosses in proportion to the length in each (assuming it
+// is deposited uniformly along the step), rather than going to the voxel of
+// the post-step point. With REPLICA_INDEXING and `SetGeometryGrid`, hits
+// are binned through tables from geometry voxel to scoring voxel, falling
+// back on position only for the geometry voxels that straddle a scoring
+// voxel boundary; see G4VoxelScoringGrid.
+enum Indexing {
+    POSITION_INDEXING,
+    REPLICA_INDEXING
+};
+
+
+// Variance
+// ========
+// With STEP_VARIANCE the sum of squares channel accumulates the square of
+// every deposit, which underestimates the uncertainty as the deposits of a
+// single history are correlated. HISTORY_VARIANCE instead buffers the
+// deposits of each event, which are summed per voxel in `EndOfEvent` and
+// only then squared, so `GetEnergyUncertainty` is the proper history by
+// history estimate. The buffer holds one entry per run of consecutive
+// deposits in a voxel; at the end of the event it is sorted by voxel and
+// flushed in order, so the cost is proportional to the number of voxels hit
+// in the event, not the size of the grid. Extra channels are not buffered.
+enum Variance {
+    STEP_VARIANCE,
+    HISTORY_VARIANCE
+};
+
+
+// Estimator
+// =========
+// DEPOSIT_ESTIMATOR scores the energy deposited by each step. The
+// TRACK_LENGTH_ESTIMATOR instead scores the length of every step, walked
+// through the scoring grid voxel by voxel as with step splitting, times the
+// coefficient at the pre-step kinetic energy from the table given to
+// `SetCoefficients` (1 by default). Every track crossing a voxel then
+// contributes, deposit or not, so fluence (`GetFluence`, length over
+// volume) or kerma (with E*mu_en/rho as the coefficient) converge much
+// faster than deposits in low density voxels. The energy channels hold the
+// length, times the coefficient and the track weight, in place of energy;
+// with integer T set the energy quanta to suit, e.g.
+// `SetQuanta(1e-6*mm, ...)` for fluence.
+enum Estimator {
+    DEPOSIT_ESTIMATOR,
+    TRACK_LENGTH_ESTIMATOR
+};
+
+
+// Convergence
+// ===========
+// Rather than guessing the number of events, `SetConvergence(target,
+// interval)` on the master (or a sequential detector) checks the
+// statistics every `interval` events and ends the run once the mean
+// relative uncertainty over a region is at most `target`: the first check
+// to converge flags the run (`HasConverged`), and every thread then ends
+// its own event loop with a soft `AbortRun` of its own run manager at the
+// end of its next event, so events in flight are completed and no worker
+// touches the master's run manager. The region is the voxels
+// scoring at least `threshold` of the maximum dose (energy without
+// `SetMass`), within the mask of `SetConvergenceMask` if given. The check
+// runs on the thread ending the event, over slabs of the grid on
+// `convergence_threads` threads that the master keeps for the purpose,
+// and reads the master records only: with LOCAL_ACCUMULATION each worker
+// merges the blocks it changed into the master every `interval` of its
+// own events and then checks, so the master holds whole events only.
+// `Reduce` at the end of a run re-arms the checks for the next (call it on
+// a sequential detector too). Uncertainties are those of
+// `GetEnergyUncertainty`, so use HISTORY_VARIANCE.
+struct G4VoxelConvergence {
+    G4long events;
+
+    // Voxels in the region, and their mean and maximum relative uncertainty
+    size_t voxels;
+    G4double mean;
+    G4double max;
+
+    G4bool converged;
+};
+
+
+template <typename T, typename Records=G4VoxelRecordArray<T>,
+          typename... Scorers>
 class G4VoxelDetector : public G4VSensitiveDetector {
+  public:
+    typedef G4VoxelScorerList<Scorers...> ScorerList;
+
+  protected:
+    // Copy of the records starting in block `block`, for snapshots
+    struct SnapshotBlock {
+        size_t block;
+        size_t first;
+        std::vector<T> values;
+    };
+    typedef std::vector<std::shared_ptr<const SnapshotBlock> > SnapshotBlocks;
+
   public:
     G4VoxelDetector(G4String name, G4ThreeVector shape,
-            G4ThreeVector spacing) : G4VSensitiveDetector(name)
+            G4ThreeVector spacing,
+            Accumulation accumulation=LOCAL_ACCUMULATION,
+            unsigned int extra_channels=0)
+        : G4VSensitiveDetector(name)
     {
         std::vector<unsigned int> shape_vector;
         shape_vector.push_back(shape.x());
@@ -65,85 +261,1392 @@ class G4VoxelDetector : public G4VSensitiveDetector {
         spacing_vector.push_back(spacing.y());
         spacing_vector.push_back(spacing.z());
 
-        Init(name, shape_vector, spacing_vector);
-    }
+        Init(name, shape_vector, spacing_vector, accumulation, extra_channels);
+    }
+
+    G4VoxelDetector(G4String name, std::vector<unsigned int> shape,
+            std::vector<double> spacing,
+            Accumulation accumulation=LOCAL_ACCUMULATION,
+            unsigned int extra_channels=0)
+        : G4VSensitiveDetector(name)
+    {
+        Init(name, shape, spacing, accumulation, extra_channels);
+    }
+
+    // Worker detector with the grid and accumulation mode of `master`,
+    // construct it on the worker thread in `ConstructSDandField`.
+    G4VoxelDetector(G4String name, G4VoxelDetector<T, Records, Scorers...>* master,
+            G4int thread_id=G4Threading::G4GetThreadId())
+        : G4VSensitiveDetector(name)
+    {
+        Configure(master->shape, master->spacing, master->accumulation,
+                  master->scorer_channel - EXTRA_CHANNEL);
+        this->binning = master->binning;
+        this->compensated = master->compensated;
+        this->padded_records = master->padded_records;
+        ConfigureChannels();
+
+        if (accumulation == LOCAL_ACCUMULATION) AllocateRecords();
+        SetMaster(master, thread_id);
+    }
+
+    void Init(G4String, std::vector<unsigned int> shape,
+            std::vector<double> spacing,
+            Accumulation accumulation=LOCAL_ACCUMULATION,
+            unsigned int extra_channels=0)
+    {
+        Configure(shape, spacing, accumulation, extra_channels);
+        AllocateRecords();
+    };
+
+    virtual ~G4VoxelDetector() {
+        // Hand anything not yet reduced to the master before the worker
+        // goes away.
+        if (master) master->RemoveWorker(this);
+
+        ReleaseRecords();
+
+        for (unsigned int i=0; i<views.size(); i++) {
+            if (views[i]) {
+                delete views[i]->GetData();
+                delete views[i];
+            }
+        }
+    };
+
+    void Initialize(G4HCofThisEvent*) {
+        event_buffer.clear();
+    };
+
+    void EndOfEvent(G4HCofThisEvent*) {
+        if (variance == HISTORY_VARIANCE) FlushEvent();
+
+        G4VoxelDetector<T, Records, Scorers...>* owner =
+            (accumulation == ATOMIC_ACCUMULATION && master) ? master : this;
+        G4long n = ++owner->events;
+
+        if (master && accumulation == LOCAL_ACCUMULATION) {
+            // Thread-local records only reach the master when flushed
+            G4bool snapshot = master->snapshot_interval > 0 &&
+                              ++snapshot_count % master->snapshot_interval == 0;
+            G4bool check = master->convergence_interval > 0 &&
+                           ++convergence_count % master->convergence_interval == 0;
+            if (snapshot || check) master->FlushWorker(this, snapshot, check);
+
+            StopIfConverged();
+            return;
+        }
+
+        if (owner->snapshot_interval > 0 && n % owner->snapshot_interval == 0) {
+            std::ostringstream filename;
+            filename << owner->snapshot_prefix << "_" << n << owner->snapshot_extension;
+            owner->WriteSnapshot(owner->snapshot_writer, filename.str());
+        }
+
+        if (owner->convergence_interval > 0 &&
+            ++owner->convergence_count % owner->convergence_interval == 0) {
+            owner->CheckConvergence();
+        }
+
+        StopIfConverged();
+    };
+    void clear() {};
+    void PrintAll() {
+        records->Print(G4cout);
+    };
+
+    void SetDebug(G4bool debug) {
+        this->debug = debug;
+    };
+
+    G4VoxelArray<T>* GetEnergyHistogram() {
+        return GetChannelHistogram(SUM_CHANNEL);
+    }
+
+    G4VoxelArray<T>* GetEnergySqHistogram() {
+        return GetChannelHistogram(SUMSQ_CHANNEL);
+    }
+
+    G4VoxelArray<T>* GetCountsHistogram() {
+        return GetChannelHistogram(COUNT_CHANNEL);
+    }
+
+    // Number of events ended since the last `Reduce` (workers) or in total
+    // (master), i.e. the number of histories for the uncertainties.
+    G4long GetNumberOfEvents() {
+        return this->events;
+    };
+
+    // Standard uncertainty of the total energy in each voxel, estimated as
+    // sqrt(N/(N - 1) * (sum(E^2) - sum(E)^2/N)) over the N histories. Only
+    // meaningful with HISTORY_VARIANCE.
+    G4VoxelArray<double>* GetEnergyUncertainty() {
+        G4VoxelArray<double>* uncertainty = new G4VoxelArray<double>(shape, spacing);
+
+        G4double n = events;
+        if (n < 2) return uncertainty;
+
+        std::vector<double>& out = *uncertainty->array;
+        std::vector<unsigned int>& s = shape;
+        std::vector<G4double>& q = quanta;
+
+        records->ForEach([&](unsigned int x, unsigned int y, unsigned int z,
+                             const T* record) {
+            G4double sum = GetSum(record, q[SUM_CHANNEL]);
+            G4double sumsq = G4VoxelDequantise(record[SUMSQ_CHANNEL], q[SUMSQ_CHANNEL]);
+
+            out[x + (size_t) s[0]*(y + (size_t) s[1]*z)] =
+                std::sqrt(std::max(n/(n - 1) * (sumsq - sum*sum/n), 0.));
+        });
+
+        return uncertainty;
+    };
+
+    // Write the voxels that were hit as text, see G4VoxelSnapshot.
+    void WriteCOO(G4String filename) {
+        TakeSnapshot()->Write(filename);
+    };
+
+    // Copy the voxels that were hit, for writing elsewhere. With
+    // ATOMIC_ACCUMULATION this may be called while workers score, at the
+    // cost of the snapshot catching some events part way.
+    std::shared_ptr<G4VoxelSnapshot<T> > TakeSnapshot() {
+        std::shared_ptr<G4VoxelSnapshot<T> > snapshot = NewSnapshot();
+        GatherSnapshot(snapshot.get(), CopySnapshotBlocks(), records->GetStride());
+
+        return snapshot;
+    };
+
+    // Take a snapshot now and write it to `filename` on the thread of
+    // `writer`. The calling thread only copies the records, picking out
+    // the voxels that were hit is left to the writer.
+    void WriteSnapshot(G4VoxelSnapshotWriter* writer, G4String filename) {
+        std::shared_ptr<G4VoxelSnapshot<T> > snapshot = NewSnapshot();
+        SnapshotBlocks blocks = CopySnapshotBlocks();
+        unsigned int stride = records->GetStride();
+
+        writer->Submit([snapshot, blocks, stride, filename]() {
+            GatherSnapshot(snapshot.get(), blocks, stride);
+            snapshot->Write(filename);
+        });
+    };
+
+    // Write a snapshot to "<prefix>_<events><extension>" with `writer` every
+    // `interval` events, from the thread that ends the event; set it on the
+    // master before the run. The records are copied block by block, and
+    // from the second snapshot on only the blocks changed since the last,
+    // the copies of the others being shared with it; these copies take up
+    // to another set of records in memory. With LOCAL_ACCUMULATION each
+    // worker merges the blocks it changed into the master every `interval`
+    // of its own events and writes a snapshot of the master, which then
+    // holds every event merged so far.
+    void SetSnapshots(G4VoxelSnapshotWriter* writer, G4long interval, G4String prefix,
+                      G4String extension=".bin") {
+        this->snapshot_writer = writer;
+        this->snapshot_interval = interval;
+        this->snapshot_prefix = prefix;
+        this->snapshot_extension = extension;
+
+        if (interval > 0) ResetSnapshotBlocks();
+    };
+
+    // End the run once the mean relative uncertainty over the region is at
+    // most `target`, checking every `interval` events, see
+    // G4VoxelConvergence. An interval of 0 turns the checks off.
+    void SetConvergence(G4double target, G4long interval, G4double threshold=0.5) {
+        this->convergence_target = target;
+        this->convergence_interval = interval;
+        this->convergence_threshold = threshold;
+        this->convergence_count = 0;
+        this->convergence_aborted = false;
+        this->convergence_stopped = false;
+    };
+
+    // Only voxels where `mask` is non-zero count towards convergence, e.g.
+    // a target volume. Combine with a threshold of 0 to use all of them.
+    template <typename U>
+    void SetConvergenceMask(G4VoxelArray<U>* mask) {
+        if (mask->GetShape() != shape) {
+            G4Exception("G4VoxelDetector::SetConvergenceMask", "ShapeMismatch",
+                    FatalException, "Mask and scoring grid differ in shape.");
+            return;
+        }
+
+        std::vector<U>& m = *mask->array;
+        convergence_mask.resize(m.size());
+        for (size_t i=0; i<m.size(); i++) {
+            convergence_mask[i] = m[i] != 0;
+        }
+    };
+
+    void SetConvergenceThreads(unsigned int threads) {
+        this->convergence_threads = threads;
+    };
+
+    // The statistics of the region now, from the records of this detector:
+    // on a master with LOCAL_ACCUMULATION those merged from the workers so
+    // far, see G4VoxelConvergence.
+    G4VoxelConvergence GetConvergence() {
+        G4AutoLock lock(&workers_mutex);
+
+        G4VoxelConvergence result;
+        result.events = events;
+        result.voxels = 0;
+        result.mean = 0;
+        result.max = 0;
+        result.converged = false;
+
+        G4double n = result.events;
+        if (n < 2) return result;
+
+        // Split the grid into slabs of z, a pass for the maximum and one for
+        // the uncertainties of the region.
+        unsigned int threads = convergence_threads;
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        threads = std::min(threads, shape[2]);
+
+        std::vector<G4double> maxima(threads, 0);
+        std::vector<size_t> counts(threads, 0);
+        std::vector<G4double> sums(threads, 0);
+        std::vector<G4double> worst(threads, 0);
+
+        ForEachSlab(threads, [&](unsigned int t, size_t i, unsigned int x,
+                                 unsigned int y, unsigned int z) {
+            G4double sum, sumsq;
+            GetMoments(x, y, z, sum, sumsq);
+            maxima[t] = std::max(maxima[t], GetRegionValue(i, sum));
+        });
+
+        G4double cut = convergence_threshold
+                     * *std::max_element(maxima.begin(), maxima.end());
+
+        ForEachSlab(threads, [&](unsigned int t, size_t i, unsigned int x,
+                                 unsigned int y, unsigned int z) {
+            if (!convergence_mask.empty() && !convergence_mask[i]) return;
+
+            G4double sum, sumsq;
+            GetMoments(x, y, z, sum, sumsq);
+            if (sum <= 0 || GetRegionValue(i, sum) < cut) return;
+
+            G4double relative =
+                std::sqrt(std::max(n/(n - 1) * (sumsq - sum*sum/n), 0.)) / sum;
+
+            counts[t]++;
+            sums[t] += relative;
+            worst[t] = std::max(worst[t], relative);
+        });
+
+        G4double total = 0;
+        for (unsigned int t=0; t<threads; t++) {
+            result.voxels += counts[t];
+            total += sums[t];
+            result.max = std::max(result.max, worst[t]);
+        }
+
+        if (result.voxels > 0) {
+            result.mean = total / result.voxels;
+            result.converged = result.mean <= convergence_target;
+        }
+
+        return result;
+    };
+
+    // Whether a check has converged this run, e.g. for the master's run
+    // action to tell a run cut short from one that ran all its events.
+    G4bool HasConverged() {
+        return this->convergence_aborted.load();
+    };
+
+    // Result of the last check made while scoring.
+    G4VoxelConvergence GetLastConvergence() {
+        G4AutoLock lock(&convergence_mutex);
+        return this->convergence;
+    };
+
+    // Mass of each scoring voxel for the dose, e.g. from
+    // `G4VoxelDataParameterisation::GetMassArray` when scoring on the
+    // placed voxels. Only the inverse is kept, voxels without mass score
+    // no dose.
+    void SetMass(G4VoxelArray<double>* mass) {
+        if (mass->GetShape() != shape) {
+            G4Exception("G4VoxelDetector::SetMass", "ShapeMismatch",
+                    FatalException, "Mass and scoring grid differ in shape.");
+            return;
+        }
+
+        std::vector<double>& m = *mass->array;
+        inverse_mass.assign(m.size(), 0);
+        for (size_t i=0; i<m.size(); i++) {
+            if (m[i] > 0) inverse_mass[i] = 1./m[i];
+        }
+    };
+
+    G4bool HasMass() {
+        return !inverse_mass.empty();
+    };
+
+    // Absorbed dose in each voxel in Geant4 units, divide by gray for Gy.
+    G4VoxelArray<double>* GetDose() {
+        return ToDose(GetEnergyValues());
+    };
+
+    // Standard uncertainty of the dose, see `GetEnergyUncertainty`.
+    G4VoxelArray<double>* GetDoseUncertainty() {
+        return ToDose(GetEnergyUncertainty());
+    };
+
+    // Track length per unit volume in each voxel for the
+    // TRACK_LENGTH_ESTIMATOR, in Geant4 units (per mm^2).
+    G4VoxelArray<double>* GetFluence() {
+        return ToFluence(GetEnergyValues());
+    };
+
+    // Standard uncertainty of the fluence, see `GetEnergyUncertainty`.
+    G4VoxelArray<double>* GetFluenceUncertainty() {
+        return ToFluence(GetEnergyUncertainty());
+    };
+
+    void SetEstimator(Estimator estimator) {
+        this->estimator = estimator;
+    };
+
+    Estimator GetEstimator() {
+        return this->estimator;
+    };
+
+    // Coefficient of the TRACK_LENGTH_ESTIMATOR as a function of kinetic
+    // energy, not owned by the detector and shared with the workers.
+    void SetCoefficients(const G4VoxelCoefficientTable* coefficients) {
+        this->coefficients = coefficients;
+    };
+
+    const G4VoxelCoefficientTable* GetCoefficients() {
+        return this->coefficients;
+    };
+
+    // Score a spectrum in each voxel, over kinetic energy or time, of the
+    // energy deposited (or the track length, see Estimator). Adds a channel
+    // per bin to the records, so call it on the master before any workers
+    // are constructed and before scoring; with many bins use float or
+    // G4VoxelFixedPoint for T and sparse records to keep memory in check.
+    void SetBinning(const G4VoxelBinning& binning) {
+        this->binning = binning;
+        ConfigureChannels();
+        ReallocateRecords();
+    };
+
+    G4bool HasBinning() {
+        return this->binning.GetNumberOfBins() > 0;
+    };
+
+    const G4VoxelBinning& GetBinning() {
+        return this->binning;
+    };
+
+    unsigned int GetBinChannel(unsigned int bin=0) {
+        return this->bin_channel + bin;
+    };
+
+    // One bin of the spectra as a new array, in the units of G4double.
+    G4VoxelArray<double>* GetBinValues(unsigned int bin) {
+        return ToDouble(GetBinChannel(bin));
+    };
+
+    // All of the spectra as new 4D data of double, of shape
+    // (x, y, z, bin) with x varying fastest, for `NumpyDataIO` or
+    // `HDF5DataIO` to write. Bin edges are from `GetBinning().GetEdges()`.
+    G4VoxelData* GetBinnedValues() {
+        unsigned int bins = binning.GetNumberOfBins();
+
+        std::vector<unsigned int> s(shape);
+        s.push_back(bins);
+        std::vector<double> sp(spacing);
+        sp.push_back(1);
+
+        G4VoxelData* data = new G4VoxelData(s, sp, sizeof(double));
+        data->type = FLOAT64;
+
+        double* out = reinterpret_cast<double*>(&data->array->front());
+        size_t length = (size_t) shape[0]*shape[1]*shape[2];
+        const G4double* q = &quanta.front() + bin_channel;
+        unsigned int first = bin_channel;
+        std::vector<unsigned int>& n = shape;
+
+        records->ForEach([&](unsigned int x, unsigned int y, unsigned int z,
+                             const T* record) {
+            size_t index = x + (size_t) n[0]*(y + (size_t) n[1]*z);
+            for (unsigned int b=0; b<bins; b++) {
+                out[index + length*b] = G4VoxelDequantise(record[first + b], q[b]);
+            }
+        });
+
+        return data;
+    };
+
+    // Keep the energy sums of float or double records with compensated
+    // (Neumaier) summation, the rounding error of each sum being carried in
+    // a channel of its own, which for the built-in channels alone takes the
+    // slot `SetRecordPadding` would leave empty. Float records then sum
+    // energy about as accurately as double in two thirds of the memory
+    // (16 rather than 24 bytes per voxel); the sum of squares and
+    // counts stay plain float (counts are exact to 2^24 per voxel). Only
+    // with LOCAL_ACCUMULATION, call it on the master before any workers
+    // are constructed and before scoring.
+    void SetCompensation(G4bool compensated) {
+        if (compensated && !std::is_floating_point<T>::value) {
+            G4Exception("G4VoxelDetector::SetCompensation", "NotFloatingPoint",
+                    JustWarning, "Integer sums are exact, not compensating.");
+            return;
+        }
+        if (compensated && accumulation == ATOMIC_ACCUMULATION) {
+            G4Exception("G4VoxelDetector::SetCompensation", "AtomicAccumulation",
+                    JustWarning, "Atomic sums cannot be compensated.");
+            return;
+        }
+
+        this->compensated = compensated;
+        ConfigureChannels();
+        ReallocateRecords();
+    };
+
+    G4bool GetCompensation() {
+        return this->compensated;
+    };
+
+    // With G4VoxelMappedRecordArray records, keep them in `filename` rather
+    // than in memory. Call it on the master before scoring, after anything
+    // that changes the records (binning, compensation, padding), as an
+    // existing file is only reused if it has the same layout; the workers
+    // keep private records in memory and reach the file when reduced, or
+    // as they score with ATOMIC_ACCUMULATION.
+    void SetRecordFile(G4String filename) {
+        this->record_file = filename;
+        ReallocateRecords();
+    };
+
+    G4String GetRecordFile() {
+        return this->record_file;
+    };
+
+    // Round the record stride up to a power of two so that no record
+    // straddles a cache line (32 rather than 24 bytes per voxel for the
+    // built-in channels of double), which fills about 10% faster but takes a
+    // third more memory. Call it on the master before any workers are
+    // constructed and before scoring.
+    void SetRecordPadding(G4bool padded) {
+        this->padded_records = padded;
+        ReallocateRecords();
+    };
+
+    G4bool GetRecordPadding() {
+        return this->padded_records;
+    };
+
+    // Checkpoints
+    // ===========
+    // Append the scoring state to `filename` for `ReadCheckpoint` to
+    // restart from: the records of every block (see `Reduce`; a brick for
+    // sparse records) changed since the previous checkpoint, the number of
+    // events and the state of the random engine. The first checkpoint, or
+    // one that is `full`, starts the file afresh with every block that has
+    // been scored; it is written to "<filename>.tmp" and renamed over the
+    // file once complete, so that the previous checkpoints survive the job
+    // being killed while writing it. Call it on the master between runs,
+    // after `Reduce`, e.g. in EndOfRunAction with the events split into
+    // several runs.
+    //
+    // Each checkpoint is a record of native endian 64-bit integers: the
+    // magic "G4VXCKP1", sizeof(T), the record stride and channels, the
+    // shape, block size, number of blocks, events, the length of the engine
+    // state and the number of blocks that follow; then the engine state,
+    // each block as its number and values, and finally "G4VXEND1".
+    void WriteCheckpoint(G4String filename, G4bool full=false) {
+        if (!dirty) full = true;
+        if (full) AssignDirty(1);
+
+        std::ostringstream engine;
+        G4Random::saveFullState(engine);
+        std::string state = engine.str();
+
+        std::vector<uint64_t> blocks;
+        for (size_t b=0; b<dirty_blocks; b++) {
+            if (!dirty[b].load(std::memory_order_relaxed)) continue;
+
+            size_t size;
+            const T* data = records->GetBlockData(b, reduce_block_size, size);
+            if (!data) continue;
+
+            for (size_t i=0; i<size; i++) {
+                if (data[i] != 0) {
+                    blocks.push_back(b);
+                    break;
+                }
+            }
+        }
+
+        G4String path = full ? filename + ".tmp" : filename;
+        std::ofstream file(path.c_str(), std::ios_base::binary |
+                (full ? std::ios_base::trunc : std::ios_base::app));
+
+        file.write("G4VXCKP1", 8);
+        uint64_t header[] = {sizeof(T), records->GetStride(), channels,
+                             shape[0], shape[1], shape[2], reduce_block_size,
+                             dirty_blocks, (uint64_t) events, state.size(),
+                             blocks.size()};
+        file.write((const char*) header, sizeof(header));
+        file.write(state.data(), state.size());
+
+        for (size_t i=0; i<blocks.size(); i++) {
+            size_t size;
+            const T* data = records->GetBlockData(blocks[i], reduce_block_size, size);
+
+            file.write((const char*) &blocks[i], sizeof(uint64_t));
+            file.write((const char*) data, size*sizeof(T));
+        }
+        file.write("G4VXEND1", 8);
+        file.flush();
+
+        if (!file) {
+            G4Exception("G4VoxelDetector::WriteCheckpoint", "WriteFailed",
+                    JustWarning, ("Cannot write checkpoint " + path).c_str());
+            return;
+        }
+
+        if (full) {
+            file.close();
+
+            if (file.fail() || std::rename(path.c_str(), filename.c_str()) != 0) {
+                G4Exception("G4VoxelDetector::WriteCheckpoint", "WriteFailed",
+                        JustWarning, ("Cannot replace checkpoint " + filename
+                                      + " with " + path).c_str());
+                return;
+            }
+        }
+
+        AssignDirty(0);
+    };
+
+    // Restore the state saved by `WriteCheckpoint` to `filename`, replaying
+    // each complete checkpoint in turn; one cut short by the job being
+    // killed while writing it is ignored. Call it on the master before the
+    // first run, with the detector built as when the checkpoints were
+    // written. Later checkpoints are appended to the same file.
+    G4bool ReadCheckpoint(G4String filename) {
+        std::ifstream file(filename.c_str(), std::ios_base::binary);
+        if (!file) return false;
+
+        records->Clear();
+        AssignDirty(0);
+
+        G4bool restored = false;
+        std::string state;
+        while (true) {
+            char magic[8];
+            uint64_t header[11];
+            if (!file.read(magic, 8) || std::memcmp(magic, "G4VXCKP1", 8) != 0) break;
+            if (!file.read((char*) header, sizeof(header))) break;
+
+            if (header[0] != sizeof(T) || header[1] != records->GetStride() ||
+                header[2] != channels || header[3] != shape[0] ||
+                header[4] != shape[1] || header[5] != shape[2] ||
+                header[6] != reduce_block_size || header[7] != dirty_blocks) {
+                G4Exception("G4VoxelDetector::ReadCheckpoint", "LayoutMismatch",
+                        FatalException, ("Checkpoint " + filename +
+                        " was written by a differently configured detector.").c_str());
+                return false;
+            }
+
+            std::string checkpoint_state(header[9], '\0');
+            if (!file.read(&checkpoint_state[0], checkpoint_state.size())) break;
+
+            // Read the whole checkpoint before applying any of it
+            std::vector<uint64_t> blocks(header[10]);
+            std::vector<size_t> offsets(header[10] + 1, 0);
+            std::vector<T> values;
+
+            G4bool complete = true;
+            for (size_t i=0; i<blocks.size() && complete; i++) {
+                complete = file.read((char*) &blocks[i], sizeof(uint64_t)) &&
+                           blocks[i] < dirty_blocks;
+                if (!complete) break;
+
+                size_t size;
+                records->GetBlockData(blocks[i], reduce_block_size, size);
+                offsets[i + 1] = offsets[i] + size;
+                values.resize(offsets[i + 1]);
+
+                complete = (G4bool) file.read((char*) &values[offsets[i]], size*sizeof(T));
+            }
+            if (!complete) break;
+            if (!file.read(magic, 8) || std::memcmp(magic, "G4VXEND1", 8) != 0) break;
+
+            for (size_t i=0; i<blocks.size(); i++) {
+                records->SetBlockData(blocks[i], reduce_block_size, &values[offsets[i]]);
+            }
+            events = header[8];
+            state = checkpoint_state;
+            restored = true;
+        }
+
+        if (restored) {
+            std::istringstream engine(state);
+            G4Random::restoreFullState(engine);
+        }
+
+        return restored;
+    };
+
+    void SetVariance(Variance variance) {
+        this->variance = variance;
+    };
+
+    Variance GetVariance() {
+        return this->variance;
+    };
+
+    // View of any channel, refreshed from the records on every call and
+    // owned by the detector.
+    G4VoxelArray<T>* GetChannelHistogram(unsigned int channel) {
+        if (!views[channel]) {
+            views[channel] = new G4VoxelArray<T>(shape, spacing);
+        }
+        records->CopyChannel(channel, views[channel]);
+
+        return views[channel];
+    };
+
+    Records* GetRecords() {
+        return this->records;
+    };
+
+    unsigned int GetChannels() {
+        return this->channels;
+    };
+
+    // Channel of value `i` of scorer `S`, after any extra channels.
+    template <typename S>
+    unsigned int GetScorerChannel(unsigned int i=0) {
+        return scorer_channel + G4VoxelScorerOffset<S, Scorers...>::value + i;
+    };
+
+    template <typename S>
+    S& GetScorer() {
+        return scorers.template Get<S>();
+    };
+
+    template <typename S>
+    G4VoxelArray<double>* GetScorerValues(unsigned int i=0) {
+        return ToDouble(GetScorerChannel<S>(i));
+    };
+
+    // Ratio of two channels in each voxel, zero where the denominator is,
+    // e.g. the dose averaged LET from the channels of G4VoxelLETScorer.
+    G4VoxelArray<double>* GetRatio(unsigned int numerator, unsigned int denominator) {
+        G4VoxelArray<double>* ratio = ToDouble(numerator);
+        G4VoxelArray<double>* d = ToDouble(denominator);
+
+        std::vector<double>& r = *ratio->array;
+        std::vector<double>& v = *d->array;
+        for (size_t i=0; i<r.size(); i++) {
+            r[i] = v[i] != 0 ? r[i]/v[i] : 0;
+        }
+
+        delete d;
+        return ratio;
+    };
+
+    // Size of one unit of the histograms for integer T, e.g. a
+    // G4VoxelFixedPoint energy of 3 is 3*energy_quantum. Must be set on the
+    // master before any workers are constructed.
+    void SetQuanta(G4double energy, G4double energysq, G4double weight) {
+        this->quanta[SUM_CHANNEL] = energy;
+        this->quanta[SUMSQ_CHANNEL] = energysq;
+        this->quanta[COUNT_CHANNEL] = weight;
+    };
+
+    // Extra channels default to the energy quantum.
+    void SetChannelQuantum(unsigned int channel, G4double quantum) {
+        this->quanta[channel] = quantum;
+    };
+
+    G4double GetChannelQuantum(unsigned int channel) {
+        return this->quanta[channel];
+    };
+
+    G4double GetEnergyQuantum() {
+        return this->quanta[SUM_CHANNEL];
+    };
+
+    G4double GetEnergySqQuantum() {
+        return this->quanta[SUMSQ_CHANNEL];
+    };
+
+    G4double GetWeightQuantum() {
+        return this->quanta[COUNT_CHANNEL];
+    };
+
+    // The histograms as new arrays of double in the units of G4double
+    // (MeV, MeV^2 and weight), whatever T is scored in.
+    G4VoxelArray<double>* GetEnergyValues() {
+        return ToDouble(SUM_CHANNEL);
+    };
+
+    G4VoxelArray<double>* GetEnergySqValues() {
+        return ToDouble(SUMSQ_CHANNEL);
+    };
+
+    G4VoxelArray<double>* GetCountsValues() {
+        return ToDouble(COUNT_CHANNEL);
+    };
+
+    G4VoxelArray<double>* ToDouble(unsigned int channel) {
+        G4VoxelArray<double>* values = new G4VoxelArray<double>(shape, spacing);
+
+        std::vector<double>& out = *values->array;
+        std::vector<unsigned int>& s = shape;
+        G4double quantum = quanta[channel];
+
+        if (channel == SUM_CHANNEL) {
+            records->ForEach([&](unsigned int x, unsigned int y, unsigned int z,
+                                 const T* record) {
+                out[x + (size_t) s[0]*(y + (size_t) s[1]*z)] = GetSum(record, quantum);
+            });
+            return values;
+        }
+
+        records->ForEach([&](unsigned int x, unsigned int y, unsigned int z,
+                             const T* record) {
+            out[x + (size_t) s[0]*(y + (size_t) s[1]*z)] =
+                G4VoxelDequantise(record[channel], quantum);
+        });
+
+        return values;
+    };
+
+    // Scale `energy` by the inverse mass in place.
+    G4VoxelArray<double>* ToDose(G4VoxelArray<double>* energy) {
+        if (!HasMass()) {
+            G4Exception("G4VoxelDetector::GetDose", "NoMass",
+                    FatalException, "Call SetMass before scoring dose.");
+            return energy;
+        }
+
+        double* e = &energy->array->front();
+        const double* inverse = &inverse_mass.front();
+        size_t n = inverse_mass.size();
+
+        for (size_t i=0; i<n; i++) {
+            e[i] *= inverse[i];
+        }
+
+        return energy;
+    };
+
+    // Divide `length` by the voxel volume in place.
+    G4VoxelArray<double>* ToFluence(G4VoxelArray<double>* length) {
+        G4double inverse_volume = 1./(spacing[0]*spacing[1]*spacing[2]);
+
+        std::vector<double>& l = *length->array;
+        for (size_t i=0; i<l.size(); i++) {
+            l[i] *= inverse_volume;
+        }
+
+        return length;
+    };
+
+    // Accumulate for `master`, call from the worker thread that owns this
+    // detector. With LOCAL_ACCUMULATION the worker keeps private histograms
+    // and registers for `Reduce`, with ATOMIC_ACCUMULATION it shares those
+    // of the master. The worker takes the channel layout of the master
+    // (extra channels, binning, compensation) and is reallocated to match;
+    // its grid must be that of the master.
+    void SetMaster(G4VoxelDetector<T, Records, Scorers...>* master,
+                   G4int thread_id=G4Threading::G4GetThreadId()) {
+        if (shape != master->shape) {
+            G4Exception("G4VoxelDetector::SetMaster", "ShapeMismatch",
+                    FatalException, "The worker grid differs from the master grid.");
+            return;
+        }
+
+        this->master = master;
+        this->accumulation = master->accumulation;
+
+        this->variance = master->variance;
+        this->indexing = master->indexing;
+        this->replica_offset = master->replica_offset;
+        this->replica_scale = master->replica_scale;
+
+        this->grid = master->grid;
+        this->grid_depth = master->grid_depth;
+        this->step_splitting = master->step_splitting;
+
+        this->estimator = master->estimator;
+        this->coefficients = master->coefficients;
+        this->scorers = master->scorers;
+
+        this->scorer_channel = master->scorer_channel;
+        this->binning = master->binning;
+        this->compensated = master->compensated;
+        this->padded_records = master->padded_records;
+        ConfigureChannels();
+        this->quanta = master->quanta;
+        this->reduce_block_size = master->reduce_block_size;
+
+        if (accumulation == ATOMIC_ACCUMULATION) {
+            ReleaseRecords();
+            records = master->records;
+        } else {
+            // Records of another layout would be merged with the wrong stride
+            if (!owns_records || records->GetChannels() != channels
+                    || records->GetStride() != master->records->GetStride()) {
+                ReleaseRecords();
+                AllocateRecords();
+            }
+            master->AddWorker(thread_id, this);
+        }
+    };
+
+    G4VoxelDetector<T, Records, Scorers...>* GetMaster() {
+        return this->master;
+    };
+
+    // Register `worker` for `Reduce`. A different worker already registered
+    // for `thread_id` is merged first, so its unreduced records are kept.
+    void AddWorker(G4int thread_id, G4VoxelDetector<T, Records, Scorers...>* worker) {
+        G4AutoLock lock(&workers_mutex);
+
+        typename std::map<G4int, G4VoxelDetector<T, Records, Scorers...>*>::iterator it;
+        it = workers.find(thread_id);
+        if (it != workers.end() && it->second != worker) {
+            MergeWorker(it->second);
+        }
+
+        workers[thread_id] = worker;
+    };
+
+    void RemoveWorker(G4VoxelDetector<T, Records, Scorers...>* worker) {
+        G4AutoLock lock(&workers_mutex);
+
+        typename std::map<G4int, G4VoxelDetector<T, Records, Scorers...>*>::iterator it;
+        for (it = workers.begin(); it != workers.end(); ++it) {
+            if (it->second == worker) {
+                MergeWorker(worker);
+
+                workers.erase(it);
+                break;
+            }
+        }
+    };
+
+    // Sum the records of all registered workers into this detector and
+    // zero them ready for the next run, for which the convergence checks
+    // start afresh. The records are split into blocks of
+    // `reduce_block_size` values that are merged in parallel by `threads`
+    // threads (the number of cores by default); each block of the master
+    // records stays in cache while the workers are streamed through it.
+    // The block size is rounded up to a whole number of records, so that
+    // no two threads ever merge into the same record.
+    void Reduce(unsigned int threads=0) {
+        G4AutoLock lock(&workers_mutex);
+
+        // Ready to check the next run afresh
+        convergence_count = 0;
+        convergence_aborted = false;
+        convergence_stopped = false;
+
+        typename std::map<G4int, G4VoxelDetector<T, Records, Scorers...>*>::iterator it;
+        for (it = workers.begin(); it != workers.end(); ++it) {
+            it->second->convergence_count = 0;
+            it->second->convergence_stopped = false;
+        }
+
+        if (workers.empty()) return;
+
+        std::vector<G4VoxelDetector<T, Records, Scorers...>*> ordered;
+        for (it = workers.begin(); it != workers.end(); ++it) {
+            ordered.push_back(it->second);
+        }
+
+        size_t blocks = records->GetBlocks(reduce_block_size);
+
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        threads = std::min<size_t>(threads, blocks);
+
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> pool;
+
+        for (unsigned int i=0; i<threads; i++) {
+            pool.push_back(std::thread([&]() {
+                for (size_t block = next++; block < blocks; block = next++) {
+                    ReduceBlock(ordered, block);
+                }
+            }));
+        }
+
+        for (unsigned int i=0; i<pool.size(); i++) {
+            pool[i].join();
+        }
+
+        for (unsigned int i=0; i<ordered.size(); i++) {
+            events += ordered[i]->events;
+            ordered[i]->events = 0;
+        }
+    };
+
+    void SetReduceBlockSize(size_t size) {
+        this->reduce_block_size = std::max<size_t>(size, 1);
+        FitReduceBlockSize();
+
+        // Blocks are also the unit of checkpoints
+        if (dirty) AssignDirty(1);
+        if (snapshot_dirty) ResetSnapshotBlocks();
+    };
+
+    size_t GetReduceBlockSize() {
+        return this->reduce_block_size;
+    };
+
+    size_t GetNumberOfWorkers() {
+        G4AutoLock lock(&workers_mutex);
+        return workers.size();
+    };
+
+    Accumulation GetAccumulation() {
+        return this->accumulation;
+    };
+
+    void SetIndexing(Indexing indexing) {
+        this->indexing = indexing;
+    };
+
+    Indexing GetIndexing() {
+        return this->indexing;
+    };
+
+    // Replica indexing with index = offset + replica*scale along each axis.
+    void SetReplicaIndexing(std::vector<unsigned int> offset,
+                            std::vector<unsigned int> scale) {
+        this->indexing = REPLICA_INDEXING;
+        this->replica_offset = offset;
+        this->replica_scale = scale;
+    };
 
-    G4VoxelDetector(G4String name, std::vector<unsigned int> shape,
-            std::vector<double> spacing) : G4VSensitiveDetector(name)
-    
-    {
-        Init(name, shape, spacing);
-    }
+    // Replica indexing in the frame of the full `array` placed by a
+    // G4VoxelDataParameterisation, allowing for its crop and merge.
+    template <typename U>
+    void SetReplicaIndexing(G4VoxelArrayBase<U>* array) {
+        std::vector<unsigned int> limits = array->GetCropLimit();
 
-    void Init(G4String name, std::vector<unsigned int> shape,
-            std::vector<double> spacing)
-    {
+        std::vector<unsigned int> offset;
+        offset.push_back(array->IsCropped() ? limits[0] : 0);
+        offset.push_back(array->IsCropped() ? limits[2] : 0);
+        offset.push_back(array->IsCropped() ? limits[4] : 0);
+
+        SetReplicaIndexing(offset, array->GetMergeSize());
+    };
+
+    // Centre of the scoring grid in the frame of the grid.
+    void SetOrigin(G4ThreeVector origin) {
+        grid.SetGrid(shape, spacing, origin);
+    };
+
+    G4ThreeVector GetOrigin() {
+        return grid.GetOrigin();
+    };
+
+    // Place the grid in the frame of the touchable `depth` levels above
+    // that of the hit (0, the default, is the volume hit itself).
+    void SetGridDepth(G4int depth) {
+        this->grid_depth = depth;
+    };
+
+    G4int GetGridDepth() {
+        return this->grid_depth;
+    };
+
+    void SetStepSplitting(G4bool step_splitting) {
+        this->step_splitting = step_splitting;
+    };
+
+    G4bool GetStepSplitting() {
+        return this->step_splitting;
+    };
+
+    // Bin replica indices through tables from the geometry voxels, of
+    // `shape` and `spacing` centred on `origin` in the grid frame, to the
+    // scoring voxels.
+    void SetGeometryGrid(std::vector<unsigned int> shape, std::vector<double> spacing,
+                         G4ThreeVector origin=G4ThreeVector()) {
+        this->indexing = REPLICA_INDEXING;
+        grid.SetGeometryGrid(shape, spacing, origin);
+    };
+
+    // As above for the voxels placed by a G4VoxelDataParameterisation of
+    // `array`, with the scoring grid in the frame of its container (three
+    // levels above the voxels) and centred on it unless moved by
+    // `SetOrigin`.
+    template <typename U>
+    void SetGeometryGrid(G4VoxelArrayBase<U>* array) {
+        SetReplicaIndexing(std::vector<unsigned int>(3, 0),
+                           std::vector<unsigned int>(3, 1));
+        SetGridDepth(3);
+        SetGeometryGrid(array->GetShape(), array->GetSpacing());
+    };
+
+    G4VoxelScoringGrid* GetGrid() {
+        return &this->grid;
+    };
+
+  private:
+    void Configure(std::vector<unsigned int> shape, std::vector<double> spacing,
+                   Accumulation accumulation, unsigned int extra_channels) {
         debug = false;
 
+        this->master = NULL;
+        this->accumulation = accumulation;
+        this->reduce_block_size = 4096;
+
         this->shape = shape;
         this->spacing = spacing;
 
-        energy_histogram = new G4VoxelArray<T>(shape, spacing);     // Total energy
-        energysq_histogram = new G4VoxelArray<T>(shape, spacing);   // Sum of squares
-        counts_histogram = new G4VoxelArray<T>(shape, spacing);     // Total hits
+        this->scorer_channel = EXTRA_CHANNEL + extra_channels;
+        this->channels = scorer_channel + ScorerList::channels;
+        this->bin_channel = channels;
+        this->compensation_channel = channels;
+        this->compensated = false;
+        this->padded_records = false;
+        this->dirty_blocks = 0;
+        this->snapshot_dirty_blocks = 0;
+
+        this->snapshot_writer = NULL;
+        this->snapshot_interval = 0;
+        this->snapshot_count = 0;
+
+        this->convergence_target = 0;
+        this->convergence_interval = 0;
+        this->convergence_threshold = 0.5;
+        this->convergence_threads = 0;
+        this->convergence_count = 0;
+        this->convergence_aborted = false;
+        this->convergence_stopped = false;
+        this->convergence_checking = false;
+        this->convergence = G4VoxelConvergence();
+
+        this->variance = STEP_VARIANCE;
+        this->events = 0;
+
+        this->indexing = POSITION_INDEXING;
+        this->replica_offset.assign(3, 0);
+        this->replica_scale.assign(3, 1);
+
+        this->grid.SetGrid(shape, spacing);
+        this->grid_depth = 0;
+        this->step_splitting = false;
+
+        this->estimator = DEPOSIT_ESTIMATOR;
+        this->coefficients = NULL;
+
+        this->quanta.assign(channels, G4VoxelEnergyQuantum);
+        this->quanta[SUMSQ_CHANNEL] = G4VoxelEnergySqQuantum;
+        this->quanta[COUNT_CHANNEL] = G4VoxelWeightQuantum;
+
+        records = NULL;
+        owns_records = false;
+
+        views.assign(channels, NULL);
     };
 
-    virtual ~G4VoxelDetector() {
-        
+    // Channels after the extra ones: the scorers, a channel per bin, then
+    // the compensation of the energy sum.
+    void ConfigureChannels() {
+        this->bin_channel = scorer_channel + ScorerList::channels;
+        this->compensation_channel = bin_channel + binning.GetNumberOfBins();
+        this->channels = compensation_channel + (compensated ? 1 : 0);
+
+        for (unsigned int i=channels; i<views.size(); i++) {
+            if (views[i]) {
+                delete views[i]->GetData();
+                delete views[i];
+            }
+        }
+        views.resize(channels, NULL);
+        quanta.resize(channels, G4VoxelEnergyQuantum);
     };
 
-    void Initialize(G4HCofThisEvent*) {};
-    void EndOfEvent(G4HCofThisEvent*) {};
-    void clear() {};
-    void PrintAll() {};
+    // Check the region every `convergence_interval` events, and flag the
+    // run on the first check that converges; exactly one thread claims it,
+    // and each thread acts on it in `StopIfConverged`. Checks that would
+    // overlap with another in progress are skipped.
+    void CheckConvergence() {
+        G4bool idle = false;
+        if (!convergence_checking.compare_exchange_strong(idle, true)) return;
 
-    void SetDebug(G4bool debug) {
-        this->debug = debug;
+        G4VoxelConvergence result = GetConvergence();
+        {
+            G4AutoLock lock(&convergence_mutex);
+            convergence = result;
+        }
+
+        if (result.converged && !convergence_aborted.exchange(true)) {
+            G4cout << "G4VoxelDetector: converged after " << result.events
+                   << " events, mean relative uncertainty " << result.mean
+                   << " over " << result.voxels << " voxels." << G4endl;
+        }
+
+        convergence_checking = false;
     };
 
-    G4VoxelArray<T>* GetEnergyHistogram() {
-        return this->energy_histogram;
-    }
+    // End the event loop of the calling thread, through its own run
+    // manager, once the run has converged: on a worker that of the worker
+    // alone, so that the master's state is never touched from here.
+    void StopIfConverged() {
+        G4VoxelDetector<T, Records, Scorers...>* owner = master ? master : this;
+        if (convergence_stopped || !owner->convergence_aborted.load()) return;
 
-    G4VoxelArray<T>* GetEnergySqHistogram() {
-        return this->energysq_histogram;
-    }
+        convergence_stopped = true;
+        G4RunManager::GetRunManager()->AbortRun(true);
+    };
 
-    G4VoxelArray<T>* GetCountsHistogram() {
-        return this->counts_histogram;
-    }
+    // Call f(thread, index, x, y, z) for every voxel, the grid split into
+    // `threads` slabs of z each on a thread of `convergence_pool`, which
+    // is kept from one check to the next. Call with `workers_mutex` held.
+    template <typename F>
+    void ForEachSlab(unsigned int threads, F f) {
+        while (convergence_pool.size() < threads) {
+            convergence_pool.push_back(std::unique_ptr<G4VoxelWorkerThread>(
+                    new G4VoxelWorkerThread()));
+        }
+
+        for (unsigned int t=0; t<threads; t++) {
+            convergence_pool[t]->Submit([&, t]() {
+                unsigned int begin = (size_t) shape[2]*t/threads;
+                unsigned int end = (size_t) shape[2]*(t + 1)/threads;
+
+                for (unsigned int z=begin; z<end; z++) {
+                    for (unsigned int y=0; y<shape[1]; y++) {
+                        for (unsigned int x=0; x<shape[0]; x++) {
+                            f(t, x + (size_t) shape[0]*(y + (size_t) shape[1]*z), x, y, z);
+                        }
+                    }
+                }
+            });
+        }
+
+        for (unsigned int t=0; t<threads; t++) {
+            convergence_pool[t]->Wait();
+        }
+    };
+
+    // Energy and energy squared of a voxel, without allocating any sparse
+    // bricks.
+    void GetMoments(unsigned int x, unsigned int y, unsigned int z,
+                    G4double& sum, G4double& sumsq) {
+        size_t index = records->GetIndex(x, y, z);
+
+        sum = G4VoxelDequantise(GetValue(index, SUM_CHANNEL), quanta[SUM_CHANNEL]);
+        if (compensated) {
+            sum += G4VoxelDequantise(GetValue(index, compensation_channel),
+                                     quanta[SUM_CHANNEL]);
+        }
+        sumsq = G4VoxelDequantise(GetValue(index, SUMSQ_CHANNEL),
+                                  quanta[SUMSQ_CHANNEL]);
+    };
+
+    // A value of the records, read atomically where workers may be adding
+    // to them.
+    T GetValue(size_t index, unsigned int channel) {
+        if (accumulation == ATOMIC_ACCUMULATION) {
+            return records->LoadValue(index, channel);
+        }
+        return records->GetValue(index, channel);
+    };
+
+    // Dose of voxel `index` with its mass, otherwise energy.
+    G4double GetRegionValue(size_t index, G4double energy) {
+        return HasMass() ? energy*inverse_mass[index] : energy;
+    };
+
+    // Sum of energy of a record, with its compensation
+    G4double GetSum(const T* record, G4double quantum) {
+        G4double sum = G4VoxelDequantise(record[SUM_CHANNEL], quantum);
+        if (compensated) {
+            sum += G4VoxelDequantise(record[compensation_channel], quantum);
+        }
+        return sum;
+    };
+
+    void ReallocateRecords() {
+        if (!owns_records) return;
+
+        ReleaseRecords();
+        AllocateRecords();
+
+        // The blocks change with the stride
+        if (dirty) AssignDirty(1);
+        if (snapshot_dirty) ResetSnapshotBlocks();
+    };
+
+    void AllocateRecords() {
+        records = NewRecords((Records*) NULL);
+        owns_records = true;
+
+        FitReduceBlockSize();
+    };
+
+    // Round the reduce block size up to a multiple of the record stride:
+    // a record straddling two blocks would be merged by two threads at
+    // once (the sum by one, its compensation by the other), and a hit on
+    // it flag only one of the blocks it changes.
+    void FitReduceBlockSize() {
+        if (!records) return;
+
+        size_t stride = records->GetStride();
+        reduce_block_size = (reduce_block_size + stride - 1) / stride * stride;
+    };
+
+    template <typename R>
+    R* NewRecords(R*) {
+        return new R(shape, channels - EXTRA_CHANNEL, padded_records);
+    };
+
+    G4VoxelMappedRecordArray<T>* NewRecords(G4VoxelMappedRecordArray<T>*) {
+        return new G4VoxelMappedRecordArray<T>(shape, channels - EXTRA_CHANNEL,
+                                               record_file, padded_records);
+    };
+
+    void ReleaseRecords() {
+        if (!owns_records) return;
+
+        delete records;
+        owns_records = false;
+    };
+
+    // Sum the records and events of a single worker into this detector,
+    // call with `workers_mutex` held.
+    void MergeWorker(G4VoxelDetector<T, Records, Scorers...>* worker) {
+        std::vector<G4VoxelDetector<T, Records, Scorers...>*> single(1, worker);
+        size_t blocks = records->GetBlocks(reduce_block_size);
+        for (size_t block=0; block<blocks; block++) {
+            ReduceBlock(single, block);
+        }
 
+        events += worker->events;
+        worker->events = 0;
+    };
+
+    // With LOCAL_ACCUMULATION snapshots or convergence checks, merge the
+    // blocks `worker` changed since it was last flushed into this detector,
+    // then write a snapshot and check for convergence as asked. Call from
+    // the worker thread.
+    void FlushWorker(G4VoxelDetector<T, Records, Scorers...>* worker,
+                     G4bool snapshot, G4bool check) {
+        {
+            G4AutoLock lock(&workers_mutex);
+
+            if (!worker->dirty) worker->AssignDirty(1);
+
+            std::vector<G4VoxelDetector<T, Records, Scorers...>*> single(1, worker);
+            for (size_t block=0; block<worker->dirty_blocks; block++) {
+                if (worker->dirty[block].exchange(0, std::memory_order_relaxed)) {
+                    ReduceBlock(single, block);
+                }
+            }
+
+            events += worker->events;
+            worker->events = 0;
+
+            if (snapshot) {
+                std::ostringstream filename;
+                filename << snapshot_prefix << "_" << events << snapshot_extension;
+                WriteSnapshot(snapshot_writer, filename.str());
+            }
+        }
+
+        if (check) CheckConvergence();
+    };
+
+    void ReduceBlock(std::vector<G4VoxelDetector<T, Records, Scorers...>*>& ordered,
+                     size_t block) {
+        for (unsigned int w=0; w<ordered.size(); w++) {
+            G4bool changed = records->MergeBlock(block, reduce_block_size,
+                    ordered[w]->records, compensated ? (G4int) compensation_channel : -1);
+            if (changed) MarkBlock(block);
+        }
+    };
+
+  public:
     G4bool ProcessHits(G4Step* aStep, G4TouchableHistory*) {
         const G4Track* aTrack = aStep->GetTrack();
-        const G4String name = aTrack->GetDefinition()->GetParticleName();
+        G4double weight = aTrack->GetWeight();
 
         G4double energy_deposit = aStep->GetTotalEnergyDeposit();
 
-        if(energy_deposit == 0) {
+        if (estimator == TRACK_LENGTH_ESTIMATOR) {
+            energy_deposit = aStep->GetStepLength();
+            if (coefficients && energy_deposit > 0) {
+                energy_deposit *= coefficients->GetValue(
+                        aStep->GetPreStepPoint()->GetKineticEnergy());
+            }
+        }
+
+        // Read the step once for all scorers
+        G4double values[ScorerList::channels + 1];
+        G4bool scored = false;
+        if (ScorerList::channels > 0) {
+            G4VoxelStepData data = {aStep, aTrack, aStep->GetTotalEnergyDeposit(),
+                                    aStep->GetStepLength(),
+                                    aStep->GetPreStepPoint()->GetKineticEnergy(),
+                                    weight};
+            scored = scorers(data, values);
+        }
+
+        // Everything is scored times the track weight: the energy (or
+        // length) w*E, its square (w*E)^2 and the scorer values and spectra,
+        // so that biased tracks give unbiased estimates.
+        energy_deposit *= weight;
+
+        G4int bin = -1;
+        if (HasBinning() && energy_deposit != 0) {
+            bin = binning.GetBin(aStep);
+        }
+
+        if(energy_deposit == 0 && !scored) {
             if (debug) G4cout << "No enegy to deposit." << G4endl << G4endl;
             return false;
         }
 
-        //G4double voxel_mass = aTrack->GetMaterial()->GetDensity() * volume;
-        G4ThreeVector world_position = aTrack->GetPosition();
-        G4ThreeVector position = aStep->GetPreStepPoint()->GetTouchableHandle()->
-            GetHistory()->GetTopTransform().TransformPoint(world_position);
+        int x_index, y_index, z_index;
+        G4bool by_position = indexing == POSITION_INDEXING;
 
-        int x_index = std::floor((position.x() + (shape[0]/2. * spacing[0])) / spacing[0]);
-        int y_index = std::floor((position.y() + (shape[1]/2. * spacing[1])) / spacing[1]);
-        int z_index = std::floor((position.z() + (shape[2]/2. * spacing[2])) / spacing[2]);
+        if (indexing == REPLICA_INDEXING) {
+            GetReplicaIndices(aStep, x_index, y_index, z_index);
+
+            if (grid.HasGeometryGrid()) {
+                int mapped = grid.Map(x_index, y_index, z_index);
+                if (mapped == G4VoxelScoringGrid::OUTSIDE) return false;
+
+                by_position = mapped == G4VoxelScoringGrid::STRADDLES;
+            }
+        }
+
+        // A step may cross several scoring voxels unless it is within a
+        // single geometry voxel mapped to one.
+        if (by_position && (step_splitting || estimator == TRACK_LENGTH_ESTIMATOR)) {
+            return SplitDeposit(aStep, energy_deposit, weight,
+                                scored ? values : NULL, bin);
+        }
+
+        if (by_position) {
+            GetPositionIndices(aStep, x_index, y_index, z_index);
+        }
 
         if (debug) {
             G4cout << "Solid name:       " << aTrack->GetVolume()->GetLogicalVolume()->GetName() << G4endl;
             G4cout << "Total energy:     " << aTrack->GetTotalEnergy() << G4endl;
             G4cout << "Enegy to deposit: " << energy_deposit << " MeV" << G4endl;
             G4cout << "Voxel material:   " << aTrack->GetMaterial()->GetName() << G4endl;
-            //G4cout << "Voxel mass:       " << voxel_mass << G4endl;
-            //G4cout << "Voxel volume:     " << volume << G4endl;
-            G4cout << "Position: "
-                   << position.x() << " "
-                   << position.y() << " "
-                   << position.z() << " " << G4endl;
             G4cout << "Histogram index: "
                    << x_index << " "
                    << y_index << " "
@@ -160,24 +1663,421 @@ class G4VoxelDetector : public G4VSensitiveDetector {
             G4cout << G4endl; // blank line
         }
         
-        energy_histogram->IncrementValue(energy_deposit, x_index, y_index, z_index);
-        energysq_histogram->IncrementValue(pow(energy_deposit, 2), x_index, y_index, z_index);
-        counts_histogram->IncrementValue(aTrack->GetWeight(), x_index, y_index, z_index);
+        if (x_index < 0 || x_index >= (int) shape[0] ||
+            y_index < 0 || y_index >= (int) shape[1] ||
+            z_index < 0 || z_index >= (int) shape[2]) {
+            return false;
+        }
+
+        if (energy_deposit != 0) {
+            Deposit(x_index, y_index, z_index, energy_deposit, weight);
+        }
+        if (scored) {
+            DepositScorers(x_index, y_index, z_index, values, weight);
+        }
+        if (bin >= 0) {
+            DepositChannel(x_index, y_index, z_index, bin_channel + bin, energy_deposit);
+        }
 
         return true;
     };
 
-public:
+    // Share the weighted `energy` and `weight`, and the scorer `values`
+    // (times `weight`) and spectrum `bin` if any, among the voxels crossed
+    // by the step.
+    G4bool SplitDeposit(G4Step* aStep, G4double energy, G4double weight,
+                        const G4double* values=NULL, G4int bin=-1) {
+        const G4AffineTransform& transform = GetGridTransform(aStep);
+
+        G4ThreeVector start =
+            transform.TransformPoint(aStep->GetPreStepPoint()->GetPosition());
+        G4ThreeVector end =
+            transform.TransformPoint(aStep->GetPostStepPoint()->GetPosition());
+
+        G4bool scored = false;
+        grid.Traverse(start, end, [&](int x, int y, int z, G4double fraction) {
+            if (energy != 0) Deposit(x, y, z, energy*fraction, weight*fraction);
+            if (values) DepositScorers(x, y, z, values, weight*fraction);
+            if (bin >= 0) DepositChannel(x, y, z, bin_channel + bin, energy*fraction);
+            scored = true;
+        });
+
+        return scored;
+    };
+
+    // From the global frame to that of the grid
+    const G4AffineTransform& GetGridTransform(G4Step* aStep) {
+        const G4NavigationHistory* history =
+            aStep->GetPreStepPoint()->GetTouchable()->GetHistory();
+
+        return history->GetTransform(history->GetDepth() - grid_depth);
+    };
+
+    // Voxel containing the step, found from the post-step position in the
+    // frame of the grid.
+    void GetPositionIndices(G4Step* aStep, int& x, int& y, int& z) {
+        G4ThreeVector world_position = aStep->GetTrack()->GetPosition();
+        G4ThreeVector position =
+            GetGridTransform(aStep).TransformPoint(world_position);
+
+        grid.GetIndices(position, x, y, z);
+
+        if (debug) {
+            G4cout << "Position: "
+                   << position.x() << " "
+                   << position.y() << " "
+                   << position.z() << " " << G4endl;
+        }
+    };
+
+    // Voxel containing the step, from the copy and replica numbers of the
+    // pre-step touchable (z, x and y at depths 0, 1 and 2).
+    void GetReplicaIndices(G4Step* aStep, int& x, int& y, int& z) {
+        const G4VTouchable* touchable = aStep->GetPreStepPoint()->GetTouchable();
+
+        x = replica_offset[0] + touchable->GetReplicaNumber(1) * replica_scale[0];
+        y = replica_offset[1] + touchable->GetReplicaNumber(2) * replica_scale[1];
+        z = replica_offset[2] + touchable->GetReplicaNumber(0) * replica_scale[2];
+    };
+
+    // Score `energy`, already multiplied by the statistical `weight` of
+    // the track, in voxel (x, y, z): w*E goes to the energy, (w*E)^2 (per
+    // step, or per history) to its square and w to the counts.
+    void Deposit(unsigned int x, unsigned int y, unsigned int z,
+                 G4double energy, G4double weight) {
+        size_t index = records->GetIndex(x, y, z);
+
+        if (variance == HISTORY_VARIANCE) {
+            if (!event_buffer.empty() && event_buffer.back().index == index) {
+                event_buffer.back().energy += energy;
+                event_buffer.back().weight += weight;
+            } else {
+                EventDeposit deposit = {index, energy, weight};
+                event_buffer.push_back(deposit);
+            }
+        } else {
+            Accumulate(index, energy, energy*energy, weight);
+        }
+    };
+
+    // Score the deposits buffered during the event, one per voxel in order
+    // of voxel index.
+    void FlushEvent() {
+        std::sort(event_buffer.begin(), event_buffer.end());
+
+        size_t i = 0;
+        while (i < event_buffer.size()) {
+            size_t index = event_buffer[i].index;
+            G4double energy = 0;
+            G4double weight = 0;
+
+            for (; i < event_buffer.size() && event_buffer[i].index == index; i++) {
+                energy += event_buffer[i].energy;
+                weight += event_buffer[i].weight;
+            }
+
+            Accumulate(index, energy, energy*energy, weight);
+        }
+
+        event_buffer.clear();
+    };
+
+    // Add `value` to an extra channel of voxel (x, y, z), e.g. from
+    // `ProcessHits` of a derived detector.
+    void DepositChannel(unsigned int x, unsigned int y, unsigned int z,
+                        unsigned int channel, G4double value) {
+        size_t index = records->GetIndex(x, y, z);
+        T* record = records->GetRecord(index);
+        MarkDirty(index);
+
+        T v = G4VoxelQuantise<T>(value, quanta[channel]);
+
+        if (accumulation == ATOMIC_ACCUMULATION) {
+            G4VoxelAtomicAdd(record + channel, v);
+        } else {
+            record[channel] += v;
+        }
+    };
+
+    // Add the scorer `values` of a step times `fraction` (the track weight,
+    // and the share of the step if split) to voxel (x, y, z).
+    void DepositScorers(unsigned int x, unsigned int y, unsigned int z,
+                        const G4double* values, G4double fraction) {
+        size_t index = records->GetIndex(x, y, z);
+        T* record = records->GetRecord(index) + scorer_channel;
+        MarkDirty(index);
+
+        const G4double* q = &quanta[scorer_channel];
+
+        for (unsigned int c=0; c<ScorerList::channels; c++) {
+            if (values[c] == 0) continue;
+
+            T v = G4VoxelQuantise<T>(values[c]*fraction, q[c]);
+            if (accumulation == ATOMIC_ACCUMULATION) {
+                G4VoxelAtomicAdd(record + c, v);
+            } else {
+                record[c] += v;
+            }
+        }
+    };
+
+  private:
+    struct EventDeposit {
+        size_t index;
+        G4double energy;
+        G4double weight;
+
+        bool operator<(const EventDeposit& other) const {
+            return index < other.index;
+        };
+    };
+
+    // Flag the block of record `index` as changed since the last
+    // checkpoint, when scoring straight into checkpointed records (those of
+    // the master, or shared with it by ATOMIC_ACCUMULATION).
+    void MarkDirty(size_t index) {
+        G4VoxelDetector<T, Records, Scorers...>* owner =
+            (master && accumulation == ATOMIC_ACCUMULATION) ? master : this;
+        if (!owner->dirty && !owner->snapshot_dirty) return;
+
+        owner->MarkBlock(records->GetBlock(index, owner->reduce_block_size));
+    };
+
+    // Flag `block` as changed for both checkpoints and snapshots.
+    void MarkBlock(size_t block) {
+        if (dirty) dirty[block].store(1, std::memory_order_relaxed);
+        if (snapshot_dirty) snapshot_dirty[block].store(1, std::memory_order_relaxed);
+    };
 
-    G4VoxelArray<T>* energy_histogram;
-    G4VoxelArray<T>* energysq_histogram;
-    G4VoxelArray<T>* counts_histogram;
+    // Set the flag of every block to `value`, (re)allocating the flags
+    // for the current number of blocks.
+    void AssignFlags(std::unique_ptr<std::atomic<unsigned char>[]>& flags,
+                     size_t& size, unsigned char value) {
+        size_t blocks = records->GetBlocks(reduce_block_size);
+        if (!flags || size != blocks) {
+            flags.reset(new std::atomic<unsigned char>[blocks]);
+            size = blocks;
+        }
+
+        for (size_t b=0; b<blocks; b++) {
+            flags[b].store(value, std::memory_order_relaxed);
+        }
+    };
+
+    void AssignDirty(unsigned char value) {
+        AssignFlags(dirty, dirty_blocks, value);
+    };
+
+    // Drop the copies of the blocks kept for snapshots, so that the next
+    // snapshot copies every block.
+    void ResetSnapshotBlocks() {
+        G4AutoLock lock(&snapshot_mutex);
+
+        AssignFlags(snapshot_dirty, snapshot_dirty_blocks, 1);
+        snapshot_blocks.assign(snapshot_dirty_blocks, std::shared_ptr<const SnapshotBlock>());
+    };
+
+    std::shared_ptr<G4VoxelSnapshot<T> > NewSnapshot() {
+        std::shared_ptr<G4VoxelSnapshot<T> > snapshot(new G4VoxelSnapshot<T>());
+        snapshot->shape = shape;
+        snapshot->spacing = spacing;
+        snapshot->events = events;
+        snapshot->channels = channels;
+        snapshot->quanta = quanta;
+
+        return snapshot;
+    };
+
+    // Copies of the records of every block for a snapshot, NULL for blocks
+    // that were never hit. After `SetSnapshots` only the blocks changed
+    // since the last snapshot are copied again.
+    SnapshotBlocks CopySnapshotBlocks() {
+        G4AutoLock lock(&snapshot_mutex);
+
+        size_t blocks = records->GetBlocks(reduce_block_size);
+        if (!snapshot_dirty || snapshot_blocks.size() != blocks) {
+            SnapshotBlocks copies(blocks);
+            for (size_t b=0; b<blocks; b++) {
+                copies[b] = CopySnapshotBlock(b);
+            }
+            return copies;
+        }
+
+        // Clear the flags before copying, so that anything scored during
+        // the copy is copied again next time.
+        std::vector<unsigned char> changed(blocks + 1, 0);
+        for (size_t b=0; b<blocks; b++) {
+            changed[b] = snapshot_dirty[b].exchange(0, std::memory_order_relaxed);
+        }
+
+        // The last record starting in a block may run on into the next
+        for (size_t b=0; b<blocks; b++) {
+            if (changed[b] || changed[b + 1]) snapshot_blocks[b] = CopySnapshotBlock(b);
+        }
+
+        return snapshot_blocks;
+    };
+
+    std::shared_ptr<const SnapshotBlock> CopySnapshotBlock(size_t b) {
+        size_t first, count;
+        const T* data = records->GetBlockRecords(b, reduce_block_size, first, count);
+        size_t size = count * records->GetStride();
+
+        G4bool hit = false;
+        for (size_t i=0; data && i<size && !hit; i++) hit = data[i] != 0;
+        if (!hit) return std::shared_ptr<const SnapshotBlock>();
+
+        std::shared_ptr<SnapshotBlock> copy(new SnapshotBlock());
+        copy->block = b;
+        copy->first = first;
+        copy->values.assign(data, data + size);
+
+        return copy;
+    };
+
+    // Fill the voxels and values of `snapshot` with the records that were
+    // hit in `blocks`, records being `stride` values apart.
+    static void GatherSnapshot(G4VoxelSnapshot<T>* snapshot, const SnapshotBlocks& blocks,
+                               unsigned int stride) {
+        unsigned int n = snapshot->channels;
+        std::vector<unsigned int>& voxels = snapshot->voxels;
+        std::vector<T>& values = snapshot->values;
+
+        for (size_t b=0; b<blocks.size(); b++) {
+            if (!blocks[b]) continue;
+
+            const SnapshotBlock& block = *blocks[b];
+            size_t count = block.values.size() / stride;
+            for (size_t i=0; i<count; i++) {
+                const T* record = &block.values[i*stride];
+
+                G4bool hit = false;
+                for (unsigned int c=0; c<n; c++) hit = hit || record[c] != 0;
+
+                unsigned int x, y, z;
+                if (!hit || !Records::GetBlockVoxel(snapshot->shape, block.block,
+                                                    block.first, i, x, y, z)) continue;
+
+                voxels.push_back(x);
+                voxels.push_back(y);
+                voxels.push_back(z);
+                values.insert(values.end(), record, record + n);
+            }
+        }
+    };
+
+    void Accumulate(size_t index, G4double energy, G4double energysq,
+                    G4double weight) {
+        T* record = records->GetRecord(index);
+        MarkDirty(index);
+
+        T e = G4VoxelQuantise<T>(energy, quanta[SUM_CHANNEL]);
+        T esq = G4VoxelQuantise<T>(energysq, quanta[SUMSQ_CHANNEL]);
+        T w = G4VoxelQuantise<T>(weight, quanta[COUNT_CHANNEL]);
+
+        if (accumulation == ATOMIC_ACCUMULATION) {
+            G4VoxelAtomicAdd(record + SUM_CHANNEL, e);
+            G4VoxelAtomicAdd(record + SUMSQ_CHANNEL, esq);
+            G4VoxelAtomicAdd(record + COUNT_CHANNEL, w);
+        } else {
+            if (compensated) {
+                G4VoxelCompensatedAdd(record[SUM_CHANNEL], record[compensation_channel], e);
+            } else {
+                record[SUM_CHANNEL] += e;
+            }
+            record[SUMSQ_CHANNEL] += esq;
+            record[COUNT_CHANNEL] += w;
+        }
+    };
+
+public:
 
     G4bool debug;
     G4double volume;
     
     std::vector<unsigned int> shape;
     std::vector<double> spacing;
+
+  protected:
+    G4VoxelDetector<T, Records, Scorers...>* master;
+    Accumulation accumulation;
+
+    Records* records;
+    G4bool owns_records;
+
+    unsigned int channels;
+    std::vector<G4double> quanta;
+
+    std::vector<G4VoxelArray<T>*> views;
+
+    Variance variance;
+    std::vector<EventDeposit> event_buffer;
+
+    // For the dose, empty until `SetMass`
+    std::vector<double> inverse_mass;
+    std::atomic<G4long> events;
+
+    Indexing indexing;
+    std::vector<unsigned int> replica_offset;
+    std::vector<unsigned int> replica_scale;
+
+    G4VoxelScoringGrid grid;
+    G4int grid_depth;
+    G4bool step_splitting;
+
+    Estimator estimator;
+    const G4VoxelCoefficientTable* coefficients;
+
+    ScorerList scorers;
+    unsigned int scorer_channel;
+
+    G4VoxelBinning binning;
+    unsigned int bin_channel;
+
+    G4bool compensated;
+    unsigned int compensation_channel;
+
+    G4bool padded_records;
+
+    // For G4VoxelMappedRecordArray, empty for memory
+    G4String record_file;
+
+    // Blocks changed since the last checkpoint, NULL before the first.
+    // Set from several threads while scoring, hence atomic.
+    std::unique_ptr<std::atomic<unsigned char>[]> dirty;
+    size_t dirty_blocks;
+
+    G4VoxelSnapshotWriter* snapshot_writer;
+    G4long snapshot_interval;
+    std::atomic<G4long> snapshot_count;
+    G4String snapshot_prefix;
+    G4String snapshot_extension;
+
+    // Copies of the blocks as of the last snapshot, shared with the
+    // snapshots still being written, and the blocks changed since
+    SnapshotBlocks snapshot_blocks;
+    std::unique_ptr<std::atomic<unsigned char>[]> snapshot_dirty;
+    size_t snapshot_dirty_blocks;
+    G4Mutex snapshot_mutex;
+
+    G4double convergence_target;
+    G4long convergence_interval;
+    G4double convergence_threshold;
+    unsigned int convergence_threads;
+    std::vector<unsigned char> convergence_mask;
+    std::atomic<G4long> convergence_count;
+    std::atomic<G4bool> convergence_aborted;
+    G4bool convergence_stopped;
+    std::vector<std::unique_ptr<G4VoxelWorkerThread> > convergence_pool;
+    std::atomic<G4bool> convergence_checking;
+    G4VoxelConvergence convergence;
+    G4Mutex convergence_mutex;
+
+    // Worker detectors keyed, and so reduced, in order of thread id
+    std::map<G4int, G4VoxelDetector<T, Records, Scorers...>*> workers;
+    G4Mutex workers_mutex;
+
+    size_t reduce_block_size;
 };
 
 
@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELFIXEDPOINT_H
+#define G4VOXELFIXEDPOINT_H
+
+// STL //
+#include <cmath>
+#include <type_traits>
+#include <stdint.h>
+
+// GEANT4 //
+#include "globals.hh"
+#include "G4SystemOfUnits.hh"
+
+
+// 64-bit fixed point scoring
+// ==========================
+// `G4VoxelDetector<G4VoxelFixedPoint>` rounds every deposit to a whole
+// number of quanta and accumulates integers. Integer addition is exact, so
+// sums (and the reduction of per-thread histograms) do not depend on the
+// order the deposits arrive in or on the number of threads, and atomic
+// accumulation is a native fetch-add. Each deposit is rounded to the
+// nearest quantum, an error of at most half a quantum per deposit with no
+// bias on average.
+//
+// The default quanta and the largest sum a voxel can then hold (2^63
+// quanta) are:
+//
+//     energy      1 eV          9.2e12 MeV
+//     energy^2    1e-9 MeV^2    9.2e9 MeV^2, 9.2e9 deposits of 1 MeV
+//     weight      2^-20         8.8e12 hits of weight 1
+//
+// Set coarser quanta with `G4VoxelDetector::SetQuanta` for voxels that see
+// more than this, finer ones for better resolution of small deposits.
+typedef int64_t G4VoxelFixedPoint;
+
+const G4double G4VoxelEnergyQuantum = 1*eV;
+const G4double G4VoxelEnergySqQuantum = 1e-9*MeV*MeV;
+const G4double G4VoxelWeightQuantum = 1./(1 << 20);
+
+
+// Convert `value` to the scoring type T, in units of `quantum` for
+// integer T. Floating point T ignore the quantum.
+template <typename T>
+inline T G4VoxelQuantise(G4double value, G4double quantum, std::true_type) {
+    G4double scaled = value / quantum;
+    return (T) (scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+template <typename T>
+inline T G4VoxelQuantise(G4double value, G4double, std::false_type) {
+    return (T) value;
+}
+
+template <typename T>
+inline T G4VoxelQuantise(G4double value, G4double quantum) {
+    return G4VoxelQuantise<T>(value, quantum, typename std::is_integral<T>::type());
+}
+
+// And back again.
+template <typename T>
+inline G4double G4VoxelDequantise(T value, G4double quantum) {
+    if (std::is_integral<T>::value) return value * quantum;
+
+    return value;
+}
+
+#endif // G4VOXELFIXEDPOINT_H
+
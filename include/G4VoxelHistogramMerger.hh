@@ -0,0 +1,539 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+//
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELHISTOGRAMMERGER_H
+#define G4VOXELHISTOGRAMMERGER_H
+
+// G4VOXELDATA //
+#include "G4VoxelData.hh"
+#include "G4VoxelArray.hh"
+#include "G4VoxelDataIO.hh"
+#include "G4VoxelDataIORegistry.hh"
+#include "G4VoxelDataStore.hh"
+#include "G4VoxelDataLogger.hh"
+
+// STL //
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// Merges the histograms of many independent jobs (e.g. the same plan run
+// with different seeds) without holding them in memory. A job is either
+// an npz archive or HDF5 file holding the arrays "sum", "sumsq" and
+// "counts" (x, y, z in MeV, MeV^2 and weight) and "events" (one element),
+// or a prefix of the .npy files "<prefix>_sum.npy" etc. as written by
+// `WriteJob`. Files are opened through the readers registered with the
+// G4VoxelDataIORegistry, so only the formats used need be linked:
+//
+//     G4VoxelDataIORegistry::GetInstance()->Register<NumpyDataIO>("NUMPY");
+//
+//     G4VoxelHistogramMerger merger;
+//     merger.AddJob("job0.npz");
+//     merger.AddJob("job1.npz", 0.5);
+//     merger.SetMass("mass.npy");
+//     merger.Merge("plan");
+//
+// The grid is merged in slabs of z, each read from every job in turn and
+// summed on one of `threads` threads, so memory is a few slabs per thread
+// whatever the number of jobs. A job of weight w counts as if each of its
+// histories had weight w: sum, sumsq and counts add w, w^2 and w times
+// the job's, events add unweighted. The merged histograms are written
+// with the same layout as a job, so merges can be merged, along with
+// "<prefix>_uncertainty.npy" (of the energy, see
+// `G4VoxelDetector::GetEnergyUncertainty`) and, with a mass, the dose and
+// its uncertainty in "<prefix>_dose.npy" and "<prefix>_dose_uncertainty.npy".
+class G4VoxelHistogramMerger {
+  public:
+    G4VoxelHistogramMerger() {
+        this->threads = 0;
+        this->thickness = 8;
+        this->events = 0;
+        this->logger = new G4VoxelDataLogger(ERROR);
+        this->logger->SetVerbose(false);
+    };
+
+    ~G4VoxelHistogramMerger() {
+        delete logger;
+    };
+
+    void AddJob(G4String path, G4double weight=1) {
+        jobs.push_back(path);
+        weights.push_back(weight);
+    };
+
+    size_t GetNumberOfJobs() {
+        return this->jobs.size();
+    };
+
+    // Mass of each voxel for the dose, a .npy file or the array "mass" of
+    // an npz or HDF5 file, read in slabs as the jobs are.
+    void SetMass(G4String path) {
+        this->mass = path;
+    };
+
+    // Threads merging slabs, the number of cores by default.
+    void SetThreads(unsigned int threads) {
+        this->threads = threads;
+    };
+
+    // Slices of z per slab.
+    void SetSlabThickness(unsigned int thickness) {
+        this->thickness = std::max<unsigned int>(thickness, 1);
+    };
+
+    void SetVerbose(G4bool verbose) {
+        this->logger->SetVerbose(verbose);
+    };
+
+    // Events of all jobs, after `Merge`.
+    G4long GetNumberOfEvents() {
+        return this->events;
+    };
+
+    std::vector<unsigned int> GetShape() {
+        return this->shape;
+    };
+
+    G4bool Merge(G4String prefix) {
+        if (jobs.empty()) {
+            logger->error << "G4VoxelHistogramMerger: No jobs to merge." << std::endl;
+            return false;
+        }
+
+        // Check the jobs agree and count their events, before writing.
+        events = 0;
+        shape.clear();
+        for (size_t j=0; j<jobs.size(); j++) {
+            G4VoxelData* data = ReadArray(jobs[j], "events");
+            G4VoxelData* header = ReadHeader(jobs[j], "sum");
+            if (!data || !header) return false;
+
+            events += (G4long) GetValue(data, 0);
+            std::vector<unsigned int> job_shape(header->shape.begin(),
+                                                header->shape.begin() + 3);
+            Release(data);
+            Release(header);
+
+            if (j == 0) shape = job_shape;
+            if (job_shape != shape) {
+                logger->error << "G4VoxelHistogramMerger: " << jobs[j]
+                              << " differs in shape." << std::endl;
+                return false;
+            }
+        }
+        logger->message << "G4VoxelHistogramMerger: " << jobs.size() << " jobs, "
+                        << events << " events" << std::endl;
+
+        std::vector<G4String> names;
+        names.push_back("sum");
+        names.push_back("sumsq");
+        names.push_back("counts");
+        names.push_back("uncertainty");
+        if (!mass.empty()) {
+            names.push_back("dose");
+            names.push_back("dose_uncertainty");
+        }
+
+        std::vector<std::fstream*> outputs;
+        G4bool created = WriteEvents(prefix + "_events.npy", events);
+        for (size_t i=0; i<names.size() && created; i++) {
+            std::fstream* file = CreateNpy(prefix + "_" + names[i] + ".npy", shape);
+            if (file) outputs.push_back(file);
+            created = file != NULL;
+        }
+        if (!created) {
+            logger->error << "G4VoxelHistogramMerger: Cannot create the outputs "
+                          << prefix << "_*.npy" << std::endl;
+            for (size_t i=0; i<outputs.size(); i++) {
+                delete outputs[i];
+            }
+            return false;
+        }
+
+        size_t slabs = (shape[2] + thickness - 1) / thickness;
+        unsigned int n = threads;
+        if (n == 0) n = std::thread::hardware_concurrency();
+        if (n == 0) n = 1;
+        n = std::min<size_t>(n, slabs);
+
+        std::atomic<size_t> next(0);
+        std::atomic<G4bool> failed(false);
+        std::vector<std::thread> pool;
+
+        for (unsigned int i=0; i<n; i++) {
+            pool.push_back(std::thread([&]() {
+                for (size_t slab = next++; slab < slabs && !failed; slab = next++) {
+                    if (!MergeSlab(slab, outputs)) failed = true;
+                }
+            }));
+        }
+
+        for (unsigned int i=0; i<pool.size(); i++) {
+            pool[i].join();
+        }
+
+        for (size_t i=0; i<outputs.size(); i++) {
+            outputs[i]->flush();
+            if (!outputs[i]->good()) {
+                logger->error << "G4VoxelHistogramMerger: Cannot write "
+                              << prefix << "_" << names[i] << ".npy" << std::endl;
+                failed = true;
+            }
+            delete outputs[i];
+        }
+
+        return !failed;
+    };
+
+    // Write the histograms of a job as "<prefix>_sum.npy", "_sumsq.npy",
+    // "_counts.npy" and "_events.npy", e.g. from the master's
+    // `GetEnergyValues()`, `GetEnergySqValues()`, `GetCountsValues()` and
+    // `GetNumberOfEvents()` in EndOfRunAction. Returns false, with a
+    // warning, if any file cannot be written.
+    static G4bool WriteJob(G4String prefix, G4VoxelArray<double>* sum,
+                           G4VoxelArray<double>* sumsq, G4VoxelArray<double>* counts,
+                           G4long events) {
+        G4VoxelArray<double>* arrays[] = {sum, sumsq, counts};
+        const char* names[] = {"sum", "sumsq", "counts"};
+
+        for (unsigned int i=0; i<3; i++) {
+            G4String filename = prefix + "_" + names[i] + ".npy";
+            std::vector<unsigned int> s = arrays[i]->GetShape();
+            std::fstream* file = CreateNpy(filename, s);
+
+            G4bool written = file != NULL;
+            if (file) {
+                std::vector<double>& values = *arrays[i]->array;
+                file->write((const char*) &values.front(), values.size()*sizeof(double));
+                file->flush();
+                written = file->good();
+                delete file;
+            }
+
+            if (!written) {
+                G4Exception("G4VoxelHistogramMerger::WriteJob", "WriteFailed",
+                        JustWarning, ("Cannot write " + filename).c_str());
+                return false;
+            }
+        }
+
+        if (!WriteEvents(prefix + "_events.npy", events)) {
+            G4Exception("G4VoxelHistogramMerger::WriteJob", "WriteFailed",
+                    JustWarning, ("Cannot write " + prefix + "_events.npy").c_str());
+            return false;
+        }
+        return true;
+    };
+
+  private:
+    // Read slab `slab` of every job and the mass, and write the merged
+    // slab of each output.
+    G4bool MergeSlab(size_t slab, std::vector<std::fstream*>& outputs) {
+        unsigned int zmin = slab*thickness;
+        unsigned int zmax = std::min(zmin + thickness, shape[2]);
+        size_t length = (size_t) shape[0]*shape[1]*(zmax - zmin);
+
+        std::vector<double> sum(length, 0);
+        std::vector<double> sumsq(length, 0);
+        std::vector<double> counts(length, 0);
+
+        const char* names[] = {"sum", "sumsq", "counts"};
+        std::vector<double>* totals[] = {&sum, &sumsq, &counts};
+
+        for (size_t j=0; j<jobs.size(); j++) {
+            G4double w = weights[j];
+            G4double factors[] = {w, w*w, w};
+
+            for (unsigned int i=0; i<3; i++) {
+                G4VoxelData* chunk = ReadSlab(jobs[j], names[i], zmin, zmax);
+                if (!chunk) return false;
+
+                Add(chunk, *totals[i], factors[i]);
+                Release(chunk);
+            }
+        }
+
+        // Uncertainty of the sum over the N histories, as for a detector
+        G4double n = events;
+        std::vector<double> uncertainty(length, 0);
+        for (size_t i=0; n > 1 && i<length; i++) {
+            uncertainty[i] = std::sqrt(std::max(
+                    n/(n - 1) * (sumsq[i] - sum[i]*sum[i]/n), 0.));
+        }
+
+        std::vector<std::vector<double>*> results;
+        results.push_back(&sum);
+        results.push_back(&sumsq);
+        results.push_back(&counts);
+        results.push_back(&uncertainty);
+
+        std::vector<double> dose, dose_uncertainty;
+        if (!mass.empty()) {
+            G4VoxelData* chunk = ReadSlab(mass, "mass", zmin, zmax);
+            if (!chunk) return false;
+
+            std::vector<double> inverse(length, 0);
+            Add(chunk, inverse, 1);
+            Release(chunk);
+
+            dose.resize(length);
+            dose_uncertainty.resize(length);
+            for (size_t i=0; i<length; i++) {
+                inverse[i] = inverse[i] > 0 ? 1./inverse[i] : 0;
+                dose[i] = sum[i]*inverse[i];
+                dose_uncertainty[i] = uncertainty[i]*inverse[i];
+            }
+            results.push_back(&dose);
+            results.push_back(&dose_uncertainty);
+        }
+
+        // Slabs are contiguous in the x fastest outputs
+        std::streamoff offset = (std::streamoff) shape[0]*shape[1]*zmin*sizeof(double);
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        for (size_t i=0; i<outputs.size(); i++) {
+            outputs[i]->seekp(header_size + offset);
+            outputs[i]->write((const char*) &results[i]->front(), length*sizeof(double));
+            if (!outputs[i]->good()) return false;
+        }
+
+        return true;
+    };
+
+    // Add `factor` times `chunk` to `total`, both over the same box with
+    // x fastest.
+    void Add(G4VoxelData* chunk, std::vector<double>& total, G4double factor) {
+        unsigned int sx = chunk->shape[0];
+        unsigned int sy = chunk->shape[1];
+        unsigned int sz = chunk->shape[2];
+
+        if (chunk->order == ROW_MAJOR) {
+            for (size_t i=0; i<total.size(); i++) {
+                total[i] += factor*GetValue(chunk, i);
+            }
+            return;
+        }
+
+        // z fastest, e.g. HDF5
+        for (unsigned int x=0; x<sx; x++) {
+            for (unsigned int y=0; y<sy; y++) {
+                for (unsigned int z=0; z<sz; z++) {
+                    total[x + (size_t) sx*(y + (size_t) sy*z)] +=
+                        factor*GetValue(chunk, z + (size_t) sz*(y + (size_t) sy*x));
+                }
+            }
+        }
+    };
+
+    static G4double GetValue(G4VoxelData* data, size_t i) {
+        const char* a = &data->array->front();
+
+        switch (data->type) {
+            case FLOAT64: return reinterpret_cast<const double*>(a)[i];
+            case FLOAT32: return reinterpret_cast<const float*>(a)[i];
+            case INT64: return reinterpret_cast<const int64_t*>(a)[i];
+            case UINT64: return reinterpret_cast<const uint64_t*>(a)[i];
+            case INT32: return reinterpret_cast<const int32_t*>(a)[i];
+            case UINT32: return reinterpret_cast<const uint32_t*>(a)[i];
+            case INT16: return reinterpret_cast<const int16_t*>(a)[i];
+            case UINT16: return reinterpret_cast<const uint16_t*>(a)[i];
+            case INT8: return reinterpret_cast<const int8_t*>(a)[i];
+            case UINT8: return reinterpret_cast<const uint8_t*>(a)[i];
+            default: return 0;
+        }
+    };
+
+    // The file holding array `name` of `path`, and a reader for it with the
+    // array selected, or NULL. Readers only report errors unless verbose,
+    // as every file is opened once per slab.
+    G4VoxelDataIO* Open(G4String path, G4String name, G4String& filename) {
+        filename = path;
+        std::ifstream single(path.c_str());
+        if (!single.good()) filename = path + "_" + name + ".npy";
+
+        G4VoxelDataIORegistry* registry = G4VoxelDataIORegistry::GetInstance();
+        G4String reader = registry->Identify(filename);
+
+        std::vector<G4VoxelDataIORegistry::Entry> entries = registry->GetEntries();
+        for (size_t i=0; i<entries.size(); i++) {
+            if (entries[i].name != reader) continue;
+
+            G4VoxelDataIO* io = entries[i].create();
+            io->SetArrayName(name);
+            io->logger->message.SetActive(logger->GetVerbose());
+            io->logger->warning.SetActive(logger->GetVerbose());
+            return io;
+        }
+
+        logger->error << "G4VoxelHistogramMerger: No reader for " << filename << std::endl;
+        return NULL;
+    };
+
+    G4VoxelData* ReadHeader(G4String path, G4String name) {
+        G4String filename;
+        G4VoxelDataIO* io = Open(path, name, filename);
+        if (!io) return NULL;
+
+        G4VoxelData* header = io->ReadHeader(filename);
+        delete io;
+
+        if (!header) {
+            logger->error << "G4VoxelHistogramMerger: Cannot read " << name
+                          << " of " << path << std::endl;
+        }
+        return header;
+    };
+
+    G4VoxelData* ReadArray(G4String path, G4String name) {
+        G4String filename;
+        G4VoxelDataIO* io = Open(path, name, filename);
+        if (!io) return NULL;
+
+        G4VoxelData* data = io->Read(filename);
+        if (io->GetHeader()) Release(io->GetHeader());
+        delete io;
+
+        if (!data) {
+            logger->error << "G4VoxelHistogramMerger: Cannot read " << name
+                          << " of " << path << std::endl;
+        }
+        return data;
+    };
+
+    G4VoxelData* ReadSlab(G4String path, G4String name,
+                          unsigned int zmin, unsigned int zmax) {
+        G4String filename;
+        G4VoxelDataIO* io = Open(path, name, filename);
+        if (!io) return NULL;
+
+        G4VoxelData* header = io->ReadHeader(filename);
+        G4VoxelData* chunk = NULL;
+        if (header) {
+            std::vector<unsigned int> s(header->shape.begin(), header->shape.begin() + 3);
+            if (s == shape) chunk = io->ReadSlab(zmin, zmax);
+            Release(header);
+        }
+        delete io;
+
+        if (!chunk) {
+            logger->error << "G4VoxelHistogramMerger: Cannot read " << name
+                          << " of " << path << std::endl;
+        }
+        return chunk;
+    };
+
+    // Arrays read are registered for garbage collection, take them back
+    // so memory stays bounded.
+    static void Release(G4VoxelData* data) {
+        G4VoxelDataStore<G4VoxelData*>::DeRegister(data);
+        delete data;
+    };
+
+    // A new .npy file of doubles in Fortran order, i.e. x fastest, with
+    // the header written and space for the data; NULL if it cannot be
+    // created.
+    static std::fstream* CreateNpy(G4String filename, std::vector<unsigned int> s) {
+        std::ostringstream dict;
+        dict << "{'descr': '<f8', 'fortran_order': True, 'shape': (";
+        for (size_t i=0; i<s.size(); i++) dict << s[i] << ", ";
+        dict << "), }";
+
+        // Magic, version 1.0 and the length of the dict, padded to
+        // `header_size`
+        std::string text = dict.str();
+        text.resize(header_size - 11, ' ');
+        text += '\n';
+
+        std::string header("\x93NUMPY\x01\x00", 8);
+        header += (char) (text.size() & 0xff);
+        header += (char) ((text.size() >> 8) & 0xff);
+        header += text;
+
+        size_t length = 1;
+        for (size_t i=0; i<s.size(); i++) length *= s[i];
+
+        std::fstream* file = new std::fstream(filename.c_str(),
+                std::ios_base::in | std::ios_base::out | std::ios_base::binary
+                | std::ios_base::trunc);
+        file->write(header.data(), header.size());
+        if (length > 0) {
+            file->seekp(header_size + length*sizeof(double) - 1);
+            file->put(0);
+        }
+        file->seekp(header_size);
+
+        if (!file->good()) {
+            delete file;
+            return NULL;
+        }
+        return file;
+    };
+
+    static G4bool WriteEvents(G4String filename, G4long events) {
+        std::vector<unsigned int> s(1, 1);
+        std::fstream* file = CreateNpy(filename, s);
+        if (!file) return false;
+
+        G4double value = events;
+        file->write((const char*) &value, sizeof(value));
+        file->flush();
+        G4bool written = file->good();
+        delete file;
+
+        return written;
+    };
+
+  private:
+    static const size_t header_size = 128;
+
+    std::vector<G4String> jobs;
+    std::vector<G4double> weights;
+    G4String mass;
+
+    unsigned int threads;
+    unsigned int thickness;
+
+    G4long events;
+    std::vector<unsigned int> shape;
+
+    std::mutex output_mutex;
+    G4VoxelDataLogger* logger;
+};
+
+#endif // G4VOXELHISTOGRAMMERGER_H
@@ -0,0 +1,252 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELMAPPEDRECORDARRAY_H
+#define G4VOXELMAPPEDRECORDARRAY_H
+
+// G4VOXELDATA //
+#include "G4VoxelRecordArray.hh"
+
+// STL //
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <type_traits>
+#include <stdint.h>
+
+// POSIX //
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// Dense records kept in a shared memory map of a `.npy` file, so that the
+// kernel writes them back to disk as they are filled: nothing needs to be
+// written at the end of a run, and the records up to the last `Sync`
+// survive the job crashing. The file holds a structured array of shape
+// (x, y, z) in Fortran order, one field per channel ("sum", "sumsq",
+// "counts", then "c3", "c4", ... for the extra channels and any padding), i.e.
+//
+//     records = numpy.load("dose.npy", mmap_mode="r")
+//     dose = records["sum"]
+//
+// The header is padded to 64 bytes so the records keep their alignment.
+// An existing file of the same header and size, e.g. left by a crashed
+// job, is mapped as it is and scoring adds to its records (the number of
+// events is not kept in it, see G4VoxelDetector::WriteCheckpoint); a file
+// of any other layout is refused rather than overwritten. Without a
+// filename the records are in anonymous memory, as for the
+// workers of a G4VoxelDetector whose master is mapped.
+template <typename T>
+class G4VoxelMappedRecordArray : public G4VoxelRecordArray<T> {
+  public:
+    G4VoxelMappedRecordArray(std::vector<unsigned int> shape,
+                             unsigned int extra_channels=0,
+                             G4String filename="",
+                             G4bool padded=false) {
+        this->Configure(shape, extra_channels, padded);
+
+        this->filename = filename;
+        this->descriptor = -1;
+        this->base = NULL;
+        this->header_size = 0;
+        this->mapped_size = this->GetBytes();
+
+        if (filename.empty()) {
+            Allocate();
+        } else {
+            Map();
+        }
+    };
+
+    virtual ~G4VoxelMappedRecordArray() {
+        if (descriptor >= 0) Sync();
+        if (base) munmap(base, mapped_size);
+        if (descriptor >= 0) close(descriptor);
+    };
+
+    // Write the records back to the file, returning once they are on disk
+    // or, with `wait` false, only scheduling the write.
+    void Sync(G4bool wait=true) {
+        if (descriptor < 0) return;
+
+        msync(base, mapped_size, wait ? MS_SYNC : MS_ASYNC);
+    };
+
+    G4bool IsMapped() {
+        return this->descriptor >= 0;
+    };
+
+    G4String GetFilename() {
+        return this->filename;
+    };
+
+    void Print(std::ostream& stream) {
+        stream << "Mapped records: " << this->length << " voxels of "
+               << this->stride << " values, " << this->GetBytes() / 1048576.
+               << " MiB in " << (IsMapped() ? filename : G4String("memory"))
+               << std::endl;
+    };
+
+    // The .npy header for the records, padded with spaces to a multiple of
+    // 64 bytes.
+    std::string GetHeader() {
+        const char order = IsLittleEndian() ? '<' : '>';
+        const char kind = std::is_floating_point<T>::value ? 'f'
+                        : std::is_signed<T>::value ? 'i' : 'u';
+
+        std::ostringstream dict;
+        dict << "{'descr': [";
+        for (unsigned int c=0; c<this->stride; c++) {
+            dict << "('" << GetFieldName(c) << "', '" << order << kind
+                 << sizeof(T) << "'), ";
+        }
+        dict << "], 'fortran_order': True, 'shape': (" << this->shape[0]
+             << ", " << this->shape[1] << ", " << this->shape[2] << "), }";
+
+        // Magic, version 1.0 and the length of the dict, then the dict
+        // ending in a newline.
+        std::string text = dict.str();
+        size_t size = 10 + text.size() + 1;
+        size = (size + 63) / 64 * 64;
+        text.resize(size - 11, ' ');
+        text += '\n';
+
+        if (text.size() > 0xffff) {
+            G4Exception("G4VoxelMappedRecordArray::GetHeader", "HeaderTooLong",
+                    FatalException, "Too many channels for a version 1.0 header.");
+        }
+
+        std::string header("\x93NUMPY\x01\x00", 8);
+        header += (char) (text.size() & 0xff);
+        header += (char) ((text.size() >> 8) & 0xff);
+        header += text;
+
+        return header;
+    };
+
+    static std::string GetFieldName(unsigned int channel) {
+        if (channel == SUM_CHANNEL) return "sum";
+        if (channel == SUMSQ_CHANNEL) return "sumsq";
+        if (channel == COUNT_CHANNEL) return "counts";
+
+        std::ostringstream name;
+        name << "c" << channel;
+        return name.str();
+    };
+
+  private:
+    void Allocate() {
+        size_t slack = std::max<size_t>(64 / sizeof(T), 1);
+        this->storage.assign(this->GetSize() + slack, (T) 0);
+
+        this->records = &this->storage[0];
+        for (size_t i=0; i<slack && ((uintptr_t) this->records) % 64 != 0; i++) {
+            this->records++;
+        }
+    };
+
+    void Map() {
+        std::string header = GetHeader();
+        header_size = header.size();
+        mapped_size = header_size + this->GetBytes();
+
+        descriptor = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+
+        struct stat status;
+        if (descriptor < 0 || fstat(descriptor, &status) != 0) {
+            G4Exception("G4VoxelMappedRecordArray::Map", "CannotOpen",
+                    FatalException, ("Cannot create " + filename).c_str());
+            return;
+        }
+
+        G4bool existing = status.st_size != 0;
+        if (existing && !HasHeader(header, status.st_size)) {
+            close(descriptor);
+            descriptor = -1;
+            G4Exception("G4VoxelMappedRecordArray::Map", "FileMismatch",
+                    FatalException, (filename + " holds records of another shape "
+                                     "or type, remove it or use another file").c_str());
+            return;
+        }
+
+        if (!existing && ftruncate(descriptor, mapped_size) != 0) {
+            G4Exception("G4VoxelMappedRecordArray::Map", "CannotOpen",
+                    FatalException, ("Cannot create " + filename).c_str());
+            return;
+        }
+
+        void* address = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, descriptor, 0);
+        if (address == MAP_FAILED) {
+            G4Exception("G4VoxelMappedRecordArray::Map", "CannotMap",
+                    FatalException, ("Cannot map " + filename).c_str());
+            return;
+        }
+
+        // A new file is zero filled by ftruncate, so are the records
+        base = (char*) address;
+        if (!existing) std::memcpy(base, header.data(), header_size);
+        this->records = reinterpret_cast<T*>(base + header_size);
+    };
+
+    // Whether the open file, of `size` bytes, starts with `header` and
+    // holds the records it describes.
+    G4bool HasHeader(const std::string& header, off_t size) {
+        if ((size_t) size != mapped_size) return false;
+
+        std::string existing(header.size(), '\0');
+        if (pread(descriptor, &existing[0], existing.size(), 0)
+                != (ssize_t) existing.size()) {
+            return false;
+        }
+
+        return existing == header;
+    };
+
+    static G4bool IsLittleEndian() {
+        const uint16_t one = 1;
+        return *reinterpret_cast<const char*>(&one) == 1;
+    };
+
+  private:
+    G4String filename;
+    int descriptor;
+
+    char* base;
+    size_t header_size;
+    size_t mapped_size;
+};
+
+#endif // G4VOXELMAPPEDRECORDARRAY_H
+
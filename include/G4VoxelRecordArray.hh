@@ -0,0 +1,291 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELRECORDARRAY_H
+#define G4VOXELRECORDARRAY_H
+
+// G4VOXELDATA //
+#include "G4VoxelArray.hh"
+#include "G4VoxelAtomic.hh"
+#include "G4VoxelCompensation.hh"
+
+// STL //
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <stdint.h>
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// Channels of a scoring record, user channels follow the built-in ones.
+enum RecordChannel {
+    SUM_CHANNEL = 0,
+    SUMSQ_CHANNEL = 1,
+    COUNT_CHANNEL = 2,
+    EXTRA_CHANNEL = 3
+};
+
+
+// Interleaved per-voxel scoring records: for each voxel the sum, sum of
+// squares, count and any extra channels are stored next to one another, so
+// scoring a hit touches one record rather than one element of each of
+// several histograms. The array is aligned to 64 bytes and by default the
+// records are packed, three channels of double taking 24 bytes. With
+// `padded` the record stride is rounded up to a power of two, so records of
+// up to 64 bytes never straddle a cache line, at the cost of the padding
+// (32 bytes for three channels of double). In examples/scoring padding
+// fills about 10% faster, but takes a third more memory and reduces about
+// 20% slower, so it is opt-in.
+//
+// Voxels are ordered x fastest (ROW_MAJOR), matching G4VoxelArray.
+//
+// G4VoxelDetector is templated on its record storage; G4VoxelRecordArray is
+// the dense default and G4VoxelSparseRecordArray a sparse alternative with
+// the same interface. Indices from `GetIndex` are only meaningful to the
+// storage that produced them.
+template <typename T>
+class G4VoxelRecordArray {
+  public:
+    G4VoxelRecordArray(std::vector<unsigned int> shape,
+                       unsigned int extra_channels=0,
+                       G4bool padded=false) {
+        Configure(shape, extra_channels, padded);
+
+        size_t slack = std::max<size_t>(64 / sizeof(T), 1);
+        this->storage.assign(length*stride + slack, (T) 0);
+
+        this->records = &this->storage[0];
+        for (size_t i=0; i<slack && ((uintptr_t) this->records) % 64 != 0; i++) {
+            this->records++;
+        }
+    };
+
+    virtual ~G4VoxelRecordArray() {};
+
+    size_t GetIndex(unsigned int x, unsigned int y, unsigned int z) {
+        return x + (size_t) shape[0]*(y + (size_t) shape[1]*z);
+    };
+
+    T* GetRecord(size_t index) {
+        return records + index*stride;
+    };
+
+    T* GetRecord(unsigned int x, unsigned int y, unsigned int z) {
+        return GetRecord(GetIndex(x, y, z));
+    };
+
+    T GetValue(size_t index, unsigned int channel) {
+        return GetRecord(index)[channel];
+    };
+
+    T GetValue(unsigned int x, unsigned int y, unsigned int z,
+               unsigned int channel) {
+        return GetRecord(x, y, z)[channel];
+    };
+
+    // GetValue while other threads add to the records atomically
+    T LoadValue(size_t index, unsigned int channel) {
+        return G4VoxelAtomicLoad(GetRecord(index) + channel);
+    };
+
+    // Call f(x, y, z, record) for every record in storage order.
+    template <typename F>
+    void ForEach(F f) {
+        T* record = records;
+        for (unsigned int z=0; z<shape[2]; z++) {
+            for (unsigned int y=0; y<shape[1]; y++) {
+                for (unsigned int x=0; x<shape[0]; x++) {
+                    f(x, y, z, (const T*) record);
+                    record += stride;
+                }
+            }
+        }
+    };
+
+    // The records split into blocks of `block_size` values for merging
+    // per-thread copies, see G4VoxelDetector::Reduce.
+    size_t GetBlocks(size_t block_size) {
+        return (GetSize() + block_size - 1) / block_size;
+    };
+
+    // Block containing record `index`
+    size_t GetBlock(size_t index, size_t block_size) {
+        return index*stride / block_size;
+    };
+
+    // The values of block `block`, `size` is set to their number.
+    T* GetBlockData(size_t block, size_t block_size, size_t& size) {
+        size_t begin = block * block_size;
+        size = std::min(GetSize(), begin + block_size) - begin;
+
+        return records + begin;
+    };
+
+    // The records starting in block `block`, which may run on into the
+    // next block: `first` is set to the index of the first and `count` to
+    // their number.
+    T* GetBlockRecords(size_t block, size_t block_size, size_t& first, size_t& count) {
+        size_t begin = block * block_size;
+        size_t end = std::min(GetSize(), begin + block_size);
+
+        first = (begin + stride - 1) / stride;
+        count = std::max((end + stride - 1) / stride, first) - first;
+
+        return records + first*stride;
+    };
+
+    // Voxel of record `i` of those `GetBlockRecords` returned for `block`,
+    // from the shape alone so that copies can be decoded elsewhere.
+    static G4bool GetBlockVoxel(const std::vector<unsigned int>& shape, size_t,
+                                size_t first, size_t i,
+                                unsigned int& x, unsigned int& y, unsigned int& z) {
+        size_t index = first + i;
+        x = index % shape[0];
+        y = (index / shape[0]) % shape[1];
+        z = index / ((size_t) shape[0]*shape[1]);
+
+        return true;
+    };
+
+    // Overwrite block `block` with values from `GetBlockData`.
+    void SetBlockData(size_t block, size_t block_size, const T* data) {
+        size_t size;
+        T* out = GetBlockData(block, block_size, size);
+
+        std::copy(data, data + size, out);
+    };
+
+    // Add block `block` of `other` into this, and zero it in `other`.
+    // Returns false if there was nothing to add.
+    G4bool MergeBlock(size_t block, size_t block_size, G4VoxelRecordArray<T>* other,
+                      G4int compensation=-1) {
+        size_t begin = block * block_size;
+        size_t end = std::min(GetSize(), begin + block_size);
+
+        T* out = records;
+        T* in = other->records;
+
+        if (compensation >= 0) {
+            G4VoxelMergeCompensated(out, in, begin, end, stride, compensation);
+        }
+
+        G4bool changed = false;
+        for (size_t i=begin; i<end; i++) {
+            changed |= in[i] != 0;
+            out[i] += in[i];
+            in[i] = 0;
+        }
+
+        return changed;
+    };
+
+    // Copy a single channel out into `view`, which must have the same
+    // shape as the records.
+    void CopyChannel(unsigned int channel, G4VoxelArray<T>* view) {
+        std::vector<T>& out = *view->array;
+        for (size_t i=0; i<length; i++) {
+            out[i] = records[i*stride + channel];
+        }
+    };
+
+    G4VoxelArray<T>* GetChannel(unsigned int channel, std::vector<double> spacing) {
+        G4VoxelArray<T>* view = new G4VoxelArray<T>(shape, spacing);
+        CopyChannel(channel, view);
+
+        return view;
+    };
+
+    void Clear() {
+        std::fill(records, records + length*stride, (T) 0);
+    };
+
+    // All records as a flat array of GetSize() values
+    T* GetData() {
+        return this->records;
+    };
+
+    size_t GetSize() {
+        return this->length * this->stride;
+    };
+
+    size_t GetBytes() {
+        return GetSize() * sizeof(T);
+    };
+
+    void Print(std::ostream& stream) {
+        stream << "Dense records: " << length << " voxels of " << stride
+               << " values, " << GetBytes() / 1048576. << " MiB" << std::endl;
+    };
+
+    size_t GetLength() {
+        return this->length;
+    };
+
+    unsigned int GetChannels() {
+        return this->channels;
+    };
+
+    unsigned int GetStride() {
+        return this->stride;
+    };
+
+    std::vector<unsigned int> GetShape() {
+        return this->shape;
+    };
+
+  protected:
+    // Layout only, for storage provided by a derived class
+    G4VoxelRecordArray() {
+        this->records = NULL;
+    };
+
+    void Configure(std::vector<unsigned int> shape, unsigned int extra_channels,
+                   G4bool padded) {
+        this->shape = shape;
+        this->length = (size_t) shape[0]*shape[1]*shape[2];
+        this->channels = EXTRA_CHANNEL + extra_channels;
+
+        this->stride = padded ? 1 : channels;
+        while (this->stride < this->channels) this->stride *= 2;
+    };
+
+  protected:
+    std::vector<unsigned int> shape;
+    size_t length;
+
+    unsigned int channels;
+    unsigned int stride;
+
+    std::vector<T> storage;
+    T* records;
+};
+
+#endif // G4VOXELRECORDARRAY_H
+
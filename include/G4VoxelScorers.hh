@@ -0,0 +1,197 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELSCORERS_H
+#define G4VOXELSCORERS_H
+
+// STL //
+#include <vector>
+#include <type_traits>
+
+// GEANT4 //
+#include "globals.hh"
+#include "G4Step.hh"
+#include "G4StepPoint.hh"
+#include "G4Track.hh"
+#include "G4ParticleDefinition.hh"
+
+
+// Scorers
+// =======
+// Quantities scored by a G4VoxelDetector alongside the energy deposit,
+// given as a compile time list, e.g.
+//
+//     G4VoxelDetector<double, G4VoxelRecordArray<double>,
+//                     G4VoxelLETScorer, G4VoxelSecondaryScorer>
+//
+// A scorer is a copyable struct with a static number of `channels` and
+//
+//     G4bool operator()(const G4VoxelStepData& step, G4double* values);
+//
+// which writes all of its `channels` values for the step and returns false
+// if there is nothing to score. The detector reads the step once, calls
+// every scorer in turn with the same G4VoxelStepData, and adds the values
+// times the track weight to the scorer's channels of the voxel record
+// (shared in proportion to length when the step is split among voxels), so
+// scorers give unweighted values and each quantity has its
+// own output array, see `G4VoxelDetector::GetScorerValues`. Scorer channels
+// are not buffered for HISTORY_VARIANCE.
+
+
+// What is read from a step before scoring, once for all scorers.
+struct G4VoxelStepData {
+    const G4Step* step;
+    const G4Track* track;
+
+    G4double energy_deposit;
+    G4double length;
+    G4double kinetic_energy;  // pre-step
+    G4double weight;          // applied by the detector
+};
+
+
+// Dose averaged LET is sum(edep*LET)/sum(edep), with the LET of a step
+// taken as edep/length; channel 0 holds edep*LET and channel 1 edep of
+// charged particles, see `G4VoxelDetector::GetRatio`.
+struct G4VoxelLETScorer {
+    static const unsigned int channels = 2;
+
+    G4bool operator()(const G4VoxelStepData& step, G4double* values) const {
+        values[0] = 0;
+        values[1] = 0;
+
+        if (step.energy_deposit <= 0 || step.length <= 0) return false;
+        if (step.track->GetDefinition()->GetPDGCharge() == 0) return false;
+
+        values[0] = step.energy_deposit * step.energy_deposit / step.length;
+        values[1] = step.energy_deposit;
+
+        return true;
+    };
+};
+
+
+// Energy deposited by each of the particles with PDG encoding `Codes`, one
+// channel per code in order.
+template <G4int... Codes>
+struct G4VoxelParticleEnergyScorer {
+    static const unsigned int channels = sizeof...(Codes);
+
+    G4bool operator()(const G4VoxelStepData& step, G4double* values) const {
+        static const G4int codes[] = {Codes...};
+        G4int code = step.track->GetDefinition()->GetPDGEncoding();
+
+        G4bool scored = false;
+        for (unsigned int i=0; i<channels; i++) {
+            values[i] = 0;
+            if (codes[i] == code) {
+                values[i] = step.energy_deposit;
+                scored = step.energy_deposit != 0;
+            }
+        }
+
+        return scored;
+    };
+};
+
+
+// Number of secondaries produced.
+struct G4VoxelSecondaryScorer {
+    static const unsigned int channels = 1;
+
+    G4bool operator()(const G4VoxelStepData& step, G4double* values) const {
+        const std::vector<const G4Track*>* secondaries =
+            step.step->GetSecondaryInCurrentStep();
+
+        values[0] = secondaries ? secondaries->size() : 0;
+
+        return values[0] != 0;
+    };
+};
+
+
+// The list of scorers of a detector, each called in turn on consecutive
+// values. Resolved at compile time so the calls are inlined.
+template <typename... Scorers>
+struct G4VoxelScorerList {
+    static const unsigned int channels = 0;
+
+    G4bool operator()(const G4VoxelStepData&, G4double*) {
+        return false;
+    };
+};
+
+template <typename Head, typename... Tail>
+struct G4VoxelScorerList<Head, Tail...> {
+    static const unsigned int channels =
+        Head::channels + G4VoxelScorerList<Tail...>::channels;
+
+    G4bool operator()(const G4VoxelStepData& step, G4double* values) {
+        G4bool scored = head(step, values);
+        G4bool scored_tail = tail(step, values + Head::channels);
+
+        return scored || scored_tail;
+    };
+
+    template <typename S>
+    S& Get() {
+        return Get<S>(std::is_same<S, Head>());
+    };
+
+    template <typename S>
+    S& Get(std::true_type) {
+        return head;
+    };
+
+    template <typename S>
+    S& Get(std::false_type) {
+        return tail.template Get<S>();
+    };
+
+    Head head;
+    G4VoxelScorerList<Tail...> tail;
+};
+
+
+// First of the values of scorer `S` in the list `Scorers`.
+template <typename S, typename... Scorers>
+struct G4VoxelScorerOffset;
+
+template <typename S, typename... Tail>
+struct G4VoxelScorerOffset<S, S, Tail...> {
+    static const unsigned int value = 0;
+};
+
+template <typename S, typename Head, typename... Tail>
+struct G4VoxelScorerOffset<S, Head, Tail...> {
+    static const unsigned int value =
+        Head::channels + G4VoxelScorerOffset<S, Tail...>::value;
+};
+
+#endif // G4VOXELSCORERS_H
+
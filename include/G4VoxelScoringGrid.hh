@@ -0,0 +1,256 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELSCORINGGRID_H
+#define G4VOXELSCORINGGRID_H
+
+// STL //
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+// GEANT4 //
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+
+// The placement of a scoring grid of `shape` voxels of `spacing` centred on
+// `origin`, in some frame of the geometry, see G4VoxelDetector. Positions
+// are mapped to indices with a single multiply-add per axis, and steps can
+// be traversed voxel by voxel (Amanatides & Woo) to share a deposit among
+// the voxels they cross.
+//
+// When hits are already binned on a geometry grid (e.g. the voxels of a
+// G4VoxelDataParameterisation) placed in the same frame, `SetGeometryGrid`
+// precomputes, per axis, the scoring voxel that contains each geometry
+// voxel. Geometry voxels that straddle a scoring voxel boundary, because
+// the grids are not aligned or the scoring grid is finer, are marked as
+// such and have to be binned by position.
+class G4VoxelScoringGrid {
+  public:
+    // Value of a mapping table entry for geometry voxels that are not
+    // within a single scoring voxel, or are outside the scoring grid.
+    static const int STRADDLES = -1;
+    static const int OUTSIDE = -2;
+
+  public:
+    G4VoxelScoringGrid() {
+        this->aligned = true;
+    };
+
+    G4VoxelScoringGrid(std::vector<unsigned int> shape, std::vector<double> spacing,
+                       G4ThreeVector origin=G4ThreeVector()) {
+        this->aligned = true;
+        SetGrid(shape, spacing, origin);
+    };
+
+    void SetGrid(std::vector<unsigned int> shape, std::vector<double> spacing,
+                 G4ThreeVector origin=G4ThreeVector()) {
+        this->shape = shape;
+        this->spacing = spacing;
+        this->origin = origin;
+
+        // index = position/spacing + (shape/2 - origin/spacing)
+        for (unsigned int i=0; i<3; i++) {
+            scale[i] = 1. / spacing[i];
+            offset[i] = shape[i]/2. - origin[i] / spacing[i];
+        }
+
+        if (!tables[0].empty()) {
+            SetGeometryGrid(geometry_shape, geometry_spacing, geometry_origin);
+        }
+    };
+
+    G4ThreeVector GetOrigin() {
+        return this->origin;
+    };
+
+    // Continuous index of `position`, voxel i spans [i, i + 1).
+    G4double GetCoordinate(G4double position, unsigned int axis) {
+        return position*scale[axis] + offset[axis];
+    };
+
+    // Voxel containing `position`, false if it is outside the grid.
+    G4bool GetIndices(G4ThreeVector position, int& x, int& y, int& z) {
+        x = (int) std::floor(GetCoordinate(position.x(), 0));
+        y = (int) std::floor(GetCoordinate(position.y(), 1));
+        z = (int) std::floor(GetCoordinate(position.z(), 2));
+
+        return Contains(x, y, z);
+    };
+
+    G4bool Contains(int x, int y, int z) {
+        return x >= 0 && x < (int) shape[0] &&
+               y >= 0 && y < (int) shape[1] &&
+               z >= 0 && z < (int) shape[2];
+    };
+
+    // Walk the straight segment from `start` to `end` through the grid and
+    // call f(x, y, z, fraction) for each voxel crossed, `fraction` being
+    // the part of the segment inside that voxel. Parts of the segment
+    // outside the grid are skipped.
+    template <typename F>
+    void Traverse(G4ThreeVector start, G4ThreeVector end, F f) {
+        const G4double infinity = std::numeric_limits<G4double>::infinity();
+
+        int index[3];
+        int step[3];
+        G4double next[3];
+        G4double delta[3];
+        int crossings = 1;
+
+        for (unsigned int i=0; i<3; i++) {
+            G4double a = GetCoordinate(start[i], i);
+            G4double b = GetCoordinate(end[i], i);
+            G4double d = b - a;
+
+            index[i] = (int) std::floor(a);
+
+            if (d > 0) {
+                step[i] = 1;
+                delta[i] = 1. / d;
+                next[i] = (index[i] + 1 - a) * delta[i];
+            } else if (d < 0) {
+                step[i] = -1;
+                delta[i] = -1. / d;
+                next[i] = (a - index[i]) * delta[i];
+            } else {
+                step[i] = 0;
+                delta[i] = infinity;
+                next[i] = infinity;
+            }
+
+            crossings += std::abs((int) std::floor(b) - index[i]);
+        }
+
+        G4double t = 0;
+        for (int n=0; n<crossings + 1 && t < 1; n++) {
+            unsigned int axis = 0;
+            if (next[1] < next[axis]) axis = 1;
+            if (next[2] < next[axis]) axis = 2;
+
+            G4double t_next = std::min(next[axis], 1.);
+            if (t_next > t && Contains(index[0], index[1], index[2])) {
+                f(index[0], index[1], index[2], t_next - t);
+            }
+            t = t_next;
+
+            index[axis] += step[axis];
+            next[axis] += delta[axis];
+        }
+    };
+
+    // Describe the geometry voxels, as placed in the same frame as this
+    // grid, and build the tables mapping them to scoring voxels.
+    void SetGeometryGrid(std::vector<unsigned int> shape, std::vector<double> spacing,
+                         G4ThreeVector origin=G4ThreeVector()) {
+        this->geometry_shape = shape;
+        this->geometry_spacing = spacing;
+        this->geometry_origin = origin;
+
+        aligned = true;
+
+        for (unsigned int axis=0; axis<3; axis++) {
+            tables[axis].resize(shape[axis]);
+
+            G4double first = origin[axis] - shape[axis]/2. * spacing[axis];
+            G4double tolerance = 1e-9 * std::min(spacing[axis], this->spacing[axis]);
+
+            for (unsigned int i=0; i<shape[axis]; i++) {
+                G4double lower = first + i*spacing[axis];
+                G4double upper = lower + spacing[axis];
+
+                int low = (int) std::floor(GetCoordinate(lower + tolerance, axis));
+                int high = (int) std::floor(GetCoordinate(upper - tolerance, axis));
+
+                if (high < 0 || low >= (int) this->shape[axis]) {
+                    tables[axis][i] = OUTSIDE;
+                } else if (low != high) {
+                    tables[axis][i] = STRADDLES;
+                    aligned = false;
+                } else {
+                    tables[axis][i] = low;
+                }
+            }
+        }
+    };
+
+    G4bool HasGeometryGrid() {
+        return !tables[0].empty();
+    };
+
+    // True if every geometry voxel lies within a single scoring voxel.
+    G4bool IsAligned() {
+        return this->aligned;
+    };
+
+    // Map geometry voxel (x, y, z) to its scoring voxel in place. Returns
+    // STRADDLES if it has to be binned by position, OUTSIDE if it is not
+    // scored at all, and 0 otherwise.
+    int Map(int& x, int& y, int& z) {
+        if (x < 0 || x >= (int) tables[0].size() ||
+            y < 0 || y >= (int) tables[1].size() ||
+            z < 0 || z >= (int) tables[2].size()) {
+            return OUTSIDE;
+        }
+
+        int mapped[3] = {tables[0][x], tables[1][y], tables[2][z]};
+
+        for (unsigned int i=0; i<3; i++) {
+            if (mapped[i] == OUTSIDE) return OUTSIDE;
+        }
+        for (unsigned int i=0; i<3; i++) {
+            if (mapped[i] == STRADDLES) return STRADDLES;
+        }
+
+        x = mapped[0];
+        y = mapped[1];
+        z = mapped[2];
+
+        return 0;
+    };
+
+  protected:
+    std::vector<unsigned int> shape;
+    std::vector<double> spacing;
+    G4ThreeVector origin;
+
+    G4double scale[3];
+    G4double offset[3];
+
+    std::vector<unsigned int> geometry_shape;
+    std::vector<double> geometry_spacing;
+    G4ThreeVector geometry_origin;
+
+    std::vector<int> tables[3];
+    G4bool aligned;
+};
+
+#endif // G4VOXELSCORINGGRID_H
+
@@ -0,0 +1,148 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELSNAPSHOTWRITER_H
+#define G4VOXELSNAPSHOTWRITER_H
+
+// G4VOXELDATA //
+#include "G4VoxelFixedPoint.hh"
+#include "G4VoxelWorkerThread.hh"
+
+// STL //
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <stdint.h>
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// The voxels of a G4VoxelDetector that were hit, copied out of its records
+// so that they can be written while scoring carries on.
+template <typename T>
+struct G4VoxelSnapshot {
+    std::vector<unsigned int> shape;
+    std::vector<double> spacing;
+    G4long events;
+
+    unsigned int channels;
+    std::vector<G4double> quanta;
+
+    // x, y and z of each voxel hit, and its `channels` values
+    std::vector<unsigned int> voxels;
+    std::vector<T> values;
+
+    // Write as text if `filename` ends in ".txt", otherwise as binary,
+    // which is much faster to write. A file that cannot be written in full
+    // is warned about and false returned.
+    G4bool Write(G4String filename) const {
+        if (filename.size() >= 4 && filename.substr(filename.size() - 4) == ".txt") {
+            return WriteText(filename);
+        }
+        return WriteBinary(filename);
+    };
+
+    // One line per voxel of "x y z energy energysq counts [extra
+    // channels...]" in MeV, MeV^2 and weight, after a commented header with
+    // the shape, spacing and number of events.
+    G4bool WriteText(G4String filename) const {
+        std::ofstream file(filename.c_str());
+
+        file << "# shape " << shape[0] << " " << shape[1] << " " << shape[2] << "\n"
+             << "# spacing " << spacing[0] << " " << spacing[1] << " " << spacing[2] << "\n"
+             << "# events " << events << "\n"
+             << "# x y z energy energysq counts" << "\n";
+        file << std::setprecision(17);
+
+        for (size_t i=0; i<voxels.size()/3; i++) {
+            file << voxels[3*i] << " " << voxels[3*i + 1] << " " << voxels[3*i + 2];
+            for (unsigned int c=0; c<channels; c++) {
+                file << " " << G4VoxelDequantise(values[i*channels + c], quanta[c]);
+            }
+            file << "\n";
+        }
+        return Written(file, filename);
+    };
+
+    // The magic "G4VXSNP1", then native endian 64-bit integers sizeof(T),
+    // channels, the shape, events and number of voxels, doubles of the
+    // spacing and the quantum of each channel, 32-bit x, y and z of each
+    // voxel and finally the values of T (in quanta) of each voxel.
+    G4bool WriteBinary(G4String filename) const {
+        std::ofstream file(filename.c_str(), std::ios_base::binary);
+
+        uint64_t header[] = {sizeof(T), channels, shape[0], shape[1], shape[2],
+                             (uint64_t) events, voxels.size()/3};
+        file.write("G4VXSNP1", 8);
+        file.write((const char*) header, sizeof(header));
+        file.write((const char*) &spacing[0], 3*sizeof(double));
+        file.write((const char*) &quanta[0], channels*sizeof(G4double));
+
+        if (!voxels.empty()) {
+            file.write((const char*) &voxels[0], voxels.size()*sizeof(unsigned int));
+            file.write((const char*) &values[0], values.size()*sizeof(T));
+        }
+        return Written(file, filename);
+    };
+
+  private:
+    // Whether everything reached the file, warning if not, e.g. a full
+    // disk or a directory that does not exist.
+    static G4bool Written(std::ofstream& file, G4String filename) {
+        file.flush();
+        if (file.good()) return true;
+
+        G4Exception("G4VoxelSnapshot::Write", "WriteFailed",
+                JustWarning, ("Cannot write snapshot " + filename).c_str());
+        return false;
+    };
+};
+
+
+// Writes snapshots on a background thread, one at a time in the order they
+// were submitted, so that the thread taking a snapshot only pays for the
+// copy. At most `max_pending` snapshots wait to be written, beyond that
+// `Submit` blocks until the oldest is done, bounding the memory held by
+// snapshots when the disk cannot keep up.
+class G4VoxelSnapshotWriter : public G4VoxelWorkerThread {
+  public:
+    G4VoxelSnapshotWriter(size_t max_pending=2)
+        : G4VoxelWorkerThread(max_pending)
+    {
+    };
+
+    // Snapshots written so far
+    size_t GetWritten() {
+        return GetCompleted();
+    };
+};
+
+#endif // G4VOXELSNAPSHOTWRITER_H
+
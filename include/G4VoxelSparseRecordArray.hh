@@ -0,0 +1,334 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef G4VOXELSPARSERECORDARRAY_H
+#define G4VOXELSPARSERECORDARRAY_H
+
+// G4VOXELDATA //
+#include "G4VoxelArray.hh"
+#include "G4VoxelRecordArray.hh"
+
+// STL //
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <ostream>
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// Block-sparse scoring records for large grids where only a small part of
+// the volume is ever hit. The grid is divided into bricks of 8x8x8 voxels,
+// and the records of a brick (laid out as in G4VoxelRecordArray, x
+// fastest within the brick) are only allocated when one of its voxels is
+// first scored. Memory is one pointer per brick plus 512 records per brick
+// hit: a 0.5 mm grid over 50x50x180 cm^3 has 3.6e9 voxels, 7.0e6 bricks
+// and takes 54 MiB before anything is scored and 16 KiB (double) per brick
+// after, where dense records would take 107 GiB.
+//
+// Bricks are allocated lock-free, so the array can be shared by threads
+// scoring with ATOMIC_ACCUMULATION.
+template <typename T>
+class G4VoxelSparseRecordArray {
+  public:
+    static const unsigned int BRICK_BITS = 3;
+    static const unsigned int BRICK_SIZE = 1 << BRICK_BITS;
+    static const unsigned int BRICK_MASK = BRICK_SIZE - 1;
+    static const unsigned int BRICK_VOXELS = BRICK_SIZE*BRICK_SIZE*BRICK_SIZE;
+    static const unsigned int VOXEL_BITS = 3*BRICK_BITS;
+
+  public:
+    G4VoxelSparseRecordArray(std::vector<unsigned int> shape,
+                             unsigned int extra_channels=0,
+                             G4bool padded=false) {
+        this->shape = shape;
+        this->length = (size_t) shape[0]*shape[1]*shape[2];
+        this->channels = EXTRA_CHANNEL + extra_channels;
+
+        this->stride = padded ? 1 : channels;
+        while (this->stride < this->channels) this->stride *= 2;
+
+        for (unsigned int i=0; i<3; i++) {
+            this->bricks_shape.push_back((shape[i] + BRICK_MASK) >> BRICK_BITS);
+        }
+
+        this->bricks.assign((size_t) bricks_shape[0]*bricks_shape[1]*bricks_shape[2], NULL);
+        this->allocated = 0;
+    };
+
+    virtual ~G4VoxelSparseRecordArray() {
+        for (size_t i=0; i<bricks.size(); i++) {
+            delete [] bricks[i];
+        }
+    };
+
+    // Index of the brick in the high bits, of the voxel within the brick in
+    // the low bits. Sorting indices sorts by brick.
+    size_t GetIndex(unsigned int x, unsigned int y, unsigned int z) {
+        size_t brick = (x >> BRICK_BITS) + (size_t) bricks_shape[0]*(
+                       (y >> BRICK_BITS) + (size_t) bricks_shape[1]*(z >> BRICK_BITS));
+        size_t voxel = (x & BRICK_MASK) + BRICK_SIZE*(
+                       (y & BRICK_MASK) + BRICK_SIZE*(z & BRICK_MASK));
+
+        return (brick << VOXEL_BITS) | voxel;
+    };
+
+    // Record of voxel `index`, allocating its brick if needed.
+    T* GetRecord(size_t index) {
+        T* brick = GetBrick(index >> VOXEL_BITS);
+        return brick + (index & (BRICK_VOXELS - 1))*stride;
+    };
+
+    T* GetRecord(unsigned int x, unsigned int y, unsigned int z) {
+        return GetRecord(GetIndex(x, y, z));
+    };
+
+    // Reading never allocates, voxels in bricks that were never hit are 0.
+    T GetValue(size_t index, unsigned int channel) {
+        T* brick = LoadBrick(index >> VOXEL_BITS);
+        if (!brick) return 0;
+
+        return brick[(index & (BRICK_VOXELS - 1))*stride + channel];
+    };
+
+    T GetValue(unsigned int x, unsigned int y, unsigned int z,
+               unsigned int channel) {
+        return GetValue(GetIndex(x, y, z), channel);
+    };
+
+    // GetValue while other threads add to the records atomically
+    T LoadValue(size_t index, unsigned int channel) {
+        T* brick = LoadBrick(index >> VOXEL_BITS);
+        if (!brick) return 0;
+
+        return G4VoxelAtomicLoad(brick + (index & (BRICK_VOXELS - 1))*stride + channel);
+    };
+
+    // Call f(x, y, z, record) for every voxel of every allocated brick,
+    // brick by brick.
+    template <typename F>
+    void ForEach(F f) {
+        for (size_t b=0; b<bricks.size(); b++) {
+            T* brick = bricks[b];
+            if (!brick) continue;
+
+            unsigned int bx = (b % bricks_shape[0]) << BRICK_BITS;
+            unsigned int by = ((b / bricks_shape[0]) % bricks_shape[1]) << BRICK_BITS;
+            unsigned int bz = (b / ((size_t) bricks_shape[0]*bricks_shape[1])) << BRICK_BITS;
+
+            for (unsigned int k=0; k<BRICK_SIZE && bz + k < shape[2]; k++) {
+                for (unsigned int j=0; j<BRICK_SIZE && by + j < shape[1]; j++) {
+                    for (unsigned int i=0; i<BRICK_SIZE && bx + i < shape[0]; i++) {
+                        size_t voxel = i + BRICK_SIZE*(j + BRICK_SIZE*k);
+                        f(bx + i, by + j, bz + k, (const T*) brick + voxel*stride);
+                    }
+                }
+            }
+        }
+    };
+
+    void CopyChannel(unsigned int channel, G4VoxelArray<T>* view) {
+        std::vector<T>& out = *view->array;
+        std::fill(out.begin(), out.end(), (T) 0);
+
+        ForEach([&](unsigned int x, unsigned int y, unsigned int z, const T* record) {
+            out[x + (size_t) shape[0]*(y + (size_t) shape[1]*z)] = record[channel];
+        });
+    };
+
+    G4VoxelArray<T>* GetChannel(unsigned int channel, std::vector<double> spacing) {
+        G4VoxelArray<T>* view = new G4VoxelArray<T>(shape, spacing);
+        CopyChannel(channel, view);
+
+        return view;
+    };
+
+    // Free every brick
+    void Clear() {
+        for (size_t i=0; i<bricks.size(); i++) {
+            delete [] bricks[i];
+            bricks[i] = NULL;
+        }
+        allocated = 0;
+    };
+
+    // One block per brick, see G4VoxelDetector::Reduce.
+    size_t GetBlocks(size_t) {
+        return bricks.size();
+    };
+
+    size_t GetBlock(size_t index, size_t) {
+        return index >> VOXEL_BITS;
+    };
+
+    // The records of brick `block`, NULL if it was never hit.
+    T* GetBlockData(size_t block, size_t, size_t& size) {
+        size = (size_t) BRICK_VOXELS*stride;
+        return bricks[block];
+    };
+
+    // The records of brick `block`, NULL if it was never hit. Safe to call
+    // while other threads allocate bricks.
+    T* GetBlockRecords(size_t block, size_t, size_t& first, size_t& count) {
+        first = block << VOXEL_BITS;
+        count = BRICK_VOXELS;
+
+        return LoadBrick(block);
+    };
+
+    // Voxel of record `i` of brick `block`, false for the voxels of bricks
+    // on the edge that lie outside the grid.
+    static G4bool GetBlockVoxel(const std::vector<unsigned int>& shape, size_t block,
+                                size_t, size_t i,
+                                unsigned int& x, unsigned int& y, unsigned int& z) {
+        size_t bricks_x = (shape[0] + BRICK_MASK) >> BRICK_BITS;
+        size_t bricks_y = (shape[1] + BRICK_MASK) >> BRICK_BITS;
+
+        x = ((block % bricks_x) << BRICK_BITS) + (i & BRICK_MASK);
+        y = (((block / bricks_x) % bricks_y) << BRICK_BITS) + ((i >> BRICK_BITS) & BRICK_MASK);
+        z = ((block / (bricks_x*bricks_y)) << BRICK_BITS) + (i >> (2*BRICK_BITS));
+
+        return x < shape[0] && y < shape[1] && z < shape[2];
+    };
+
+    void SetBlockData(size_t block, size_t, const T* data) {
+        T* out = GetBrick(block);
+        std::copy(data, data + (size_t) BRICK_VOXELS*stride, out);
+    };
+
+    // Add brick `block` of `other` into this and free it in `other`. Where
+    // this has no such brick, that of `other` is simply taken over. Returns
+    // false if there was nothing to add.
+    G4bool MergeBlock(size_t block, size_t, G4VoxelSparseRecordArray<T>* other,
+                      G4int compensation=-1) {
+        T* in = other->bricks[block];
+        if (!in) return false;
+
+        other->bricks[block] = NULL;
+        other->allocated--;
+
+        if (!bricks[block]) {
+            bricks[block] = in;
+            allocated++;
+            return true;
+        }
+
+        T* out = bricks[block];
+        if (compensation >= 0) {
+            G4VoxelMergeCompensated(out, in, 0, (size_t) BRICK_VOXELS*stride,
+                                    stride, compensation);
+        }
+
+        for (size_t i=0; i<(size_t) BRICK_VOXELS*stride; i++) {
+            out[i] += in[i];
+        }
+        delete [] in;
+
+        return true;
+    };
+
+    // Memory in use, including the brick table
+    size_t GetBytes() {
+        return bricks.size()*sizeof(T*) + GetAllocatedBricks()*GetBrickBytes();
+    };
+
+    size_t GetBrickBytes() {
+        return (size_t) BRICK_VOXELS * stride * sizeof(T);
+    };
+
+    size_t GetAllocatedBricks() {
+        return this->allocated;
+    };
+
+    size_t GetBricks() {
+        return this->bricks.size();
+    };
+
+    void Print(std::ostream& stream) {
+        stream << "Sparse records: " << length << " voxels in "
+               << bricks.size() << " bricks, " << GetAllocatedBricks()
+               << " allocated (" << 100. * GetAllocatedBricks() / bricks.size()
+               << "%), " << GetBytes() / 1048576. << " MiB, dense would take "
+               << length * stride * sizeof(T) / 1048576. << " MiB" << std::endl;
+    };
+
+    size_t GetLength() {
+        return this->length;
+    };
+
+    unsigned int GetChannels() {
+        return this->channels;
+    };
+
+    unsigned int GetStride() {
+        return this->stride;
+    };
+
+    std::vector<unsigned int> GetShape() {
+        return this->shape;
+    };
+
+  protected:
+    T* LoadBrick(size_t brick) {
+        return reinterpret_cast<std::atomic<T*>*>(&bricks[brick])->load(
+                std::memory_order_acquire);
+    };
+
+    T* GetBrick(size_t brick) {
+        T* records = LoadBrick(brick);
+        if (records) return records;
+
+        // First hit in this brick, another thread may get there first
+        T* fresh = new T[(size_t) BRICK_VOXELS*stride]();
+        T* expected = NULL;
+
+        if (reinterpret_cast<std::atomic<T*>*>(&bricks[brick])->compare_exchange_strong(
+                    expected, fresh, std::memory_order_acq_rel)) {
+            allocated++;
+            return fresh;
+        }
+
+        delete [] fresh;
+        return expected;
+    };
+
+  protected:
+    std::vector<unsigned int> shape;
+    size_t length;
+
+    unsigned int channels;
+    unsigned int stride;
+
+    std::vector<unsigned int> bricks_shape;
+    std::vector<T*> bricks;
+    std::atomic<size_t> allocated;
+};
+
+#endif // G4VOXELSPARSERECORDARRAY_H
+
@@ -0,0 +1,481 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+
+#ifndef G4VOXELWOODCOCK_H
+#define G4VOXELWOODCOCK_H
+
+// G4VOXELDATA //
+#include "G4VoxelArray.hh"
+#include "G4VoxelDataParameterisation.hh"
+
+// STL //
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cfloat>
+
+// GEANT4 //
+#include "globals.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4GeometryTolerance.hh"
+#include "G4VFastSimulationModel.hh"
+#include "G4FastTrack.hh"
+#include "G4FastStep.hh"
+#include "G4Region.hh"
+#include "G4Gamma.hh"
+#include "G4ProcessManager.hh"
+#include "G4ProcessVector.hh"
+#include "G4VEmProcess.hh"
+#include "G4ParticleChangeForGamma.hh"
+#include "G4MaterialCutsCouple.hh"
+#include "G4DynamicParticle.hh"
+#include "G4Track.hh"
+#include "G4Step.hh"
+#include "Randomize.hh"
+
+
+// The voxel volume of a G4VoxelDataParameterisation as the envelope of a
+// fast simulation model: a region with the container box as its root, and
+// the material of every placed voxel (after cropping and merging) as an
+// index into the distinct materials. Build it once on the master in
+// `Construct`, after the parameterisation, and share it with the
+// G4VoxelWoodcockModel of every thread.
+class G4VoxelWoodcockEnvelope {
+  public:
+    template <typename T, typename U>
+    G4VoxelWoodcockEnvelope(G4VoxelDataParameterisation<T, U>* parameterisation,
+                            G4String name="voxeldata_region") {
+        G4LogicalVolume* container = parameterisation->GetContainerLogicalVolume();
+
+        if (container->IsRootRegion()) {
+            region = container->GetRegion();
+        } else {
+            region = new G4Region(name);
+            region->AddRootLogicalVolume(container);
+        }
+
+        indices = parameterisation->GetMaterialIndexArray(materials);
+        shape = parameterisation->GetPlacedShape();
+        spacing = parameterisation->GetPlacedSpacing();
+    };
+
+    ~G4VoxelWoodcockEnvelope() {
+        delete indices->GetData();
+        delete indices;
+    };
+
+  public:
+    G4Region* region;
+
+    G4VoxelArray<unsigned short>* indices;
+    std::vector<G4Material*> materials;
+
+    std::vector<unsigned int> shape;
+    std::vector<double> spacing;
+};
+
+
+// Woodcock (delta) tracking of photons through the voxel volume. Rather
+// than stepping from voxel to voxel, photons fly with the largest
+// attenuation coefficient of any material in the volume at their energy
+// (the majorant), and at each flight's end a lookup of the voxel decides
+// if the collision is real, with probability mu/majorant, or virtual, in
+// which case the photon flies on. Real collisions are handed to the photon
+// processes themselves at the end of the same step, in the material of the
+// voxel they fall in, so only they (and not every voxel boundary) end a
+// step and cost a navigation. The gain grows with the number of voxels a
+// photon crosses between interactions, and shrinks when a few voxels of a
+// much denser material set the majorant.
+//
+// Attenuation coefficients are tabulated on first use, on each thread,
+// from the CrossSectionPerVolume of every G4VEmProcess of the gamma, on a
+// grid uniform in log energy. Coefficients and majorant are interpolated
+// alike, so the majorant bounds every material at every energy. Photons
+// outside `SetEnergyRange` are tracked as usual.
+//
+//     // Construct(), master, after parameterisation->Construct(...)
+//     envelope = new G4VoxelWoodcockEnvelope(parameterisation);
+//
+//     // ConstructSDandField(), every thread
+//     new G4VoxelWoodcockModel(envelope);
+//
+//     // Physics list
+//     G4FastSimulationPhysics* fast_simulation = new G4FastSimulationPhysics();
+//     fast_simulation->ActivateFastSimulation("gamma");
+//     physics_list->RegisterPhysics(fast_simulation);
+//
+// Each step of a photon in the volume is a flight ended by a real
+// collision, whose deposit and secondaries are at the post-step point:
+// score with POSITION_INDEXING, as REPLICA_INDEXING would put the deposit
+// in the voxel the flight started from, and track length estimators and
+// step splitting see whole flights rather than voxel crossings. Only
+// electromagnetic processes act on photons inside the volume, and
+// G4GammaGeneralProcess, which hides them, must be disabled with
+// `G4EmParameters::Instance()->SetGeneralProcessActive(false)`. Photons are
+// not also biased by a G4VoxelBiasingOperator while in the volume.
+class G4VoxelWoodcockModel : public G4VFastSimulationModel {
+  public:
+    G4VoxelWoodcockModel(G4VoxelWoodcockEnvelope* envelope,
+                         G4String name="G4VoxelWoodcockModel")
+        : G4VFastSimulationModel(name, envelope->region)
+    {
+        this->envelope = envelope;
+        this->indices = &envelope->indices->array->front();
+
+        for (unsigned int i=0; i<3; i++) {
+            this->shape[i] = envelope->shape[i];
+            this->half[i] = envelope->shape[i] * envelope->spacing[i] / 2.;
+            this->inverse_spacing[i] = 1. / envelope->spacing[i];
+        }
+
+        this->tolerance = G4GeometryTolerance::GetInstance()->GetSurfaceTolerance();
+
+        this->minimum_energy = 1*keV;
+        this->maximum_energy = 100*MeV;
+        this->bins_per_decade = 100;
+        this->tabulated = false;
+    };
+
+    virtual ~G4VoxelWoodcockModel() {};
+
+    // Energies of the photons to track, and points per decade of the
+    // attenuation tables. Call before the first run.
+    void SetEnergyRange(G4double minimum, G4double maximum, G4int bins_per_decade=100) {
+        this->minimum_energy = minimum;
+        this->maximum_energy = maximum;
+        this->bins_per_decade = std::max(bins_per_decade, 1);
+        this->tabulated = false;
+    };
+
+    G4bool IsApplicable(const G4ParticleDefinition& particle) {
+        return &particle == G4Gamma::Definition();
+    };
+
+    G4bool ModelTrigger(const G4FastTrack& fast_track) {
+        G4double energy = fast_track.GetPrimaryTrack()->GetKineticEnergy();
+        if (energy < minimum_energy || energy > maximum_energy) return false;
+
+        // Photons left on the surface on their way out
+        return GetExitDistance(fast_track.GetPrimaryTrackLocalPosition(),
+                               fast_track.GetPrimaryTrackLocalDirection()) > tolerance;
+    };
+
+    void DoIt(const G4FastTrack& fast_track, G4FastStep& fast_step) {
+        if (!tabulated) Tabulate();
+
+        const G4Track* track = fast_track.GetPrimaryTrack();
+        G4ThreeVector position = fast_track.GetPrimaryTrackLocalPosition();
+        G4ThreeVector direction = fast_track.GetPrimaryTrackLocalDirection();
+        G4double energy = track->GetKineticEnergy();
+
+        G4double length;
+        G4bool collided = Fly(position, direction, energy,
+                              GetExitDistance(position, direction), length);
+
+        G4ThreeVector end = position + length*direction;
+        G4double time = track->GetGlobalTime() + length/c_light;
+
+        fast_step.ProposePrimaryTrackFinalPosition(end);
+        fast_step.ProposePrimaryTrackFinalTime(time);
+        fast_step.ProposePrimaryTrackPathLength(length);
+
+        // Absorbed
+        if (collided && !Interact(fast_track, fast_step, end, time, energy, direction)) {
+            return;
+        }
+
+        fast_step.ProposePrimaryTrackFinalMomentumDirection(direction);
+        fast_step.ProposePrimaryTrackFinalKineticEnergy(energy);
+
+        // Leaving the volume, or scattered out of the energy range
+        if (!collided || energy < minimum_energy || energy > maximum_energy) {
+            ResetProcesses(track);
+        }
+    };
+
+    // Delta tracking from `position` along `direction`, for at most
+    // `distance`. Returns true with `length` the distance to the first real
+    // collision, or false with `length` = `distance` if there is none.
+    G4bool Fly(const G4ThreeVector& position, const G4ThreeVector& direction,
+               G4double energy, G4double distance, G4double& length) {
+        G4int bin;
+        G4double fraction;
+        GetBin(energy, bin, fraction);
+
+        size_t n = envelope->materials.size();
+        const G4double* lower = &totals[bin*n];
+        const G4double* upper = lower + n;
+
+        G4double majorant = (1 - fraction)*majorants[bin] + fraction*majorants[bin + 1];
+
+        length = 0;
+        if (majorant <= 0) {
+            length = distance;
+            return false;
+        }
+
+        while (true) {
+            length -= std::log(G4UniformRand()) / majorant;
+
+            if (length >= distance) {
+                length = distance;
+                return false;
+            }
+
+            unsigned short material = indices[Locate(position + length*direction)];
+            G4double mu = (1 - fraction)*lower[material] + fraction*upper[material];
+
+            if (G4UniformRand()*majorant < mu) return true;
+        }
+    };
+
+    // Largest attenuation coefficient of any material in the volume.
+    G4double GetMajorant(G4double energy) {
+        if (!tabulated) Tabulate();
+
+        G4int bin;
+        G4double fraction;
+        GetBin(energy, bin, fraction);
+
+        return (1 - fraction)*majorants[bin] + fraction*majorants[bin + 1];
+    };
+
+  private:
+    // Distance along `direction` to the surface of the container box, in
+    // its frame.
+    G4double GetExitDistance(const G4ThreeVector& position,
+                             const G4ThreeVector& direction) const {
+        G4double distance = DBL_MAX;
+
+        for (unsigned int i=0; i<3; i++) {
+            if (direction[i] > 0) {
+                distance = std::min(distance, (half[i] - position[i]) / direction[i]);
+            } else if (direction[i] < 0) {
+                distance = std::min(distance, (-half[i] - position[i]) / direction[i]);
+            }
+        }
+
+        return std::max(distance, 0.);
+    };
+
+    // Index (x fastest) of the placed voxel holding `position`.
+    size_t Locate(const G4ThreeVector& position) const {
+        G4int index[3];
+
+        for (unsigned int i=0; i<3; i++) {
+            index[i] = (G4int) ((position[i] + half[i]) * inverse_spacing[i]);
+            index[i] = std::min(std::max(index[i], 0), (G4int) shape[i] - 1);
+        }
+
+        return index[0] + (size_t) shape[0]*(index[1] + (size_t) shape[1]*index[2]);
+    };
+
+    void GetBin(G4double energy, G4int& bin, G4double& fraction) const {
+        G4double x = (std::log(energy) - log_minimum) * inverse_width;
+
+        bin = std::min(std::max((G4int) x, 0), bins - 1);
+        fraction = std::min(std::max(x - bin, 0.), 1.);
+    };
+
+    // Have the photon process chosen in proportion to its coefficient in
+    // the voxel at `position` (local) act on the photon there, at `time`.
+    // Returns false if it was absorbed.
+    G4bool Interact(const G4FastTrack& fast_track, G4FastStep& fast_step,
+                    const G4ThreeVector& position, G4double time,
+                    G4double& energy, G4ThreeVector& direction) {
+        const G4Track* track = fast_track.GetPrimaryTrack();
+
+        G4int bin;
+        G4double fraction;
+        GetBin(energy, bin, fraction);
+
+        size_t n = envelope->materials.size();
+        size_t np = processes.size();
+        size_t material = indices[Locate(position)];
+        const G4double* lower = &partials[(bin*n + material)*np];
+        const G4double* upper = &partials[((bin + 1)*n + material)*np];
+
+        G4double mu = 0;
+        for (size_t i=0; i<np; i++) {
+            mu += (1 - fraction)*lower[i] + fraction*upper[i];
+        }
+
+        G4double sample = G4UniformRand()*mu;
+        size_t selected = np - 1;
+        for (size_t i=0; i<np; i++) {
+            sample -= (1 - fraction)*lower[i] + fraction*upper[i];
+            if (sample < 0) {
+                selected = i;
+                break;
+            }
+        }
+
+        // The processes take the material from the pre-step point, which is
+        // still where the flight started: lend it that of the collision.
+        G4StepPoint* point = track->GetStep()->GetPreStepPoint();
+        G4Material* start_material = point->GetMaterial();
+        const G4MaterialCutsCouple* start_couple = point->GetMaterialCutsCouple();
+        point->SetMaterial(envelope->materials[material]);
+        point->SetMaterialCutsCouple(couples[material]);
+
+        // As the stepping manager would, had the process limited the step
+        G4ForceCondition condition;
+        processes[selected]->PostStepGetPhysicalInteractionLength(*track, 0, &condition);
+        G4VParticleChange* change =
+            processes[selected]->PostStepDoIt(*track, *track->GetStep());
+
+        point->SetMaterial(start_material);
+        point->SetMaterialCutsCouple(start_couple);
+
+        G4int secondaries = change->GetNumberOfSecondaries();
+        fast_step.SetNumberOfSecondaryTracks(secondaries);
+        for (G4int i=0; i<secondaries; i++) {
+            G4Track* secondary = change->GetSecondary(i);
+
+            G4Track* copy = fast_step.CreateSecondaryTrack(*secondary->GetDynamicParticle(),
+                    position, time, true);
+            copy->SetWeight(secondary->GetWeight());
+
+            delete secondary;
+        }
+        change->Clear();
+
+        fast_step.ProposeTotalEnergyDeposited(change->GetLocalEnergyDeposit());
+
+        G4ParticleChangeForGamma* gamma = static_cast<G4ParticleChangeForGamma*>(change);
+        if (change->GetTrackStatus() == fStopAndKill ||
+            gamma->GetProposedKineticEnergy() <= 0) {
+            fast_step.KillPrimaryTrack();
+            return false;
+        }
+
+        energy = gamma->GetProposedKineticEnergy();
+        direction = fast_track.GetAffineTransformation()->TransformAxis(
+                gamma->GetProposedMomentumDirection());
+        fast_step.ProposePrimaryTrackFinalPolarization(gamma->GetProposedPolarization(), false);
+
+        return true;
+    };
+
+    // Photons left to the usual tracking sample fresh interaction lengths,
+    // as if starting out.
+    void ResetProcesses(const G4Track* track) {
+        for (size_t i=0; i<processes.size(); i++) {
+            processes[i]->StartTracking(const_cast<G4Track*>(track));
+        }
+    };
+
+    void Tabulate() {
+        processes.clear();
+
+        G4ProcessVector* list = G4Gamma::Definition()->GetProcessManager()->GetProcessList();
+        for (G4int i=0; i<list->entries(); i++) {
+            G4VEmProcess* process = dynamic_cast<G4VEmProcess*>((*list)[i]);
+            if (process) processes.push_back(process);
+        }
+
+        if (processes.empty()) {
+            G4Exception("G4VoxelWoodcockModel::Tabulate", "NoProcesses", FatalException,
+                    "No electromagnetic processes are registered for gamma.");
+            return;
+        }
+
+        G4double decades = std::log10(maximum_energy / minimum_energy);
+        bins = std::max((G4int) std::ceil(decades * bins_per_decade), 1);
+        log_minimum = std::log(minimum_energy);
+        inverse_width = bins / std::log(maximum_energy / minimum_energy);
+
+        std::vector<G4Material*>& materials = envelope->materials;
+        size_t n = materials.size();
+        size_t np = processes.size();
+
+        couples.assign(n, NULL);
+        for (size_t i=0; i<n; i++) {
+            couples[i] = envelope->region->FindCouple(materials[i]);
+
+            if (!couples[i]) {
+                G4Exception("G4VoxelWoodcockModel::Tabulate", "NoCouple", FatalException,
+                        ("No production cuts for " + materials[i]->GetName()).c_str());
+                return;
+            }
+        }
+
+        majorants.assign(bins + 1, 0);
+        totals.assign((bins + 1)*n, 0);
+        partials.assign((bins + 1)*n*np, 0);
+
+        for (G4int i=0; i<=bins; i++) {
+            G4double energy = std::exp(log_minimum + i / inverse_width);
+
+            for (size_t j=0; j<n; j++) {
+                G4double& total = totals[i*n + j];
+
+                for (size_t k=0; k<np; k++) {
+                    G4double mu = processes[k]->CrossSectionPerVolume(energy, couples[j]);
+                    partials[(i*n + j)*np + k] = mu;
+                    total += mu;
+                }
+
+                majorants[i] = std::max(majorants[i], total);
+            }
+        }
+
+        tabulated = true;
+    };
+
+  private:
+    G4VoxelWoodcockEnvelope* envelope;
+    const unsigned short* indices;
+
+    unsigned int shape[3];
+    G4double half[3];
+    G4double inverse_spacing[3];
+    G4double tolerance;
+
+    // Attenuation tables, point by point in energy: the majorant, the total
+    // of each material and the coefficient of each process and material,
+    // from the couple of each material.
+    G4double minimum_energy;
+    G4double maximum_energy;
+    G4int bins_per_decade;
+    G4int bins;
+    G4double log_minimum;
+    G4double inverse_width;
+    G4bool tabulated;
+
+    std::vector<G4VEmProcess*> processes;
+    std::vector<const G4MaterialCutsCouple*> couples;
+    std::vector<G4double> majorants;
+    std::vector<G4double> totals;
+    std::vector<G4double> partials;
+};
+
+#endif // G4VOXELWOODCOCK_H
+
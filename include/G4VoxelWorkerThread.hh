@@ -0,0 +1,139 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+
+#ifndef G4VOXELWORKERTHREAD_H
+#define G4VOXELWORKERTHREAD_H
+
+// STL //
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// A background thread running the jobs submitted to it one at a time, in
+// order. At most `max_pending` jobs wait to be run, beyond that `Submit`
+// blocks until the oldest is done, bounding the memory held by queued jobs
+// when the thread cannot keep up. The thread lives as long as the object,
+// so a set of them serves as a pool kept from one job to the next.
+class G4VoxelWorkerThread {
+  public:
+    G4VoxelWorkerThread(size_t max_pending=2) {
+        this->max_pending = std::max<size_t>(max_pending, 1);
+        this->stopping = false;
+        this->busy = false;
+        this->completed = 0;
+        this->seconds = 0;
+
+        this->thread = std::thread(&G4VoxelWorkerThread::Run, this);
+    };
+
+    // Runs anything still pending before returning.
+    virtual ~G4VoxelWorkerThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+    };
+
+    void Submit(std::function<void()> job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return jobs.size() < max_pending; });
+
+        jobs.push_back(job);
+        changed.notify_all();
+    };
+
+    // Block until every job submitted so far has run.
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return jobs.empty() && !busy; });
+    };
+
+    size_t GetCompleted() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return this->completed;
+    };
+
+    // Time spent running jobs on the background thread
+    double GetSeconds() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return this->seconds;
+    };
+
+  private:
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            changed.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+
+            std::function<void()> job = jobs.front();
+            jobs.pop_front();
+            busy = true;
+            changed.notify_all();
+
+            lock.unlock();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            job();
+            double elapsed = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+            lock.lock();
+
+            busy = false;
+            completed++;
+            seconds += elapsed;
+            changed.notify_all();
+        }
+    };
+
+  private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    std::deque<std::function<void()> > jobs;
+    size_t max_pending;
+    G4bool stopping;
+    G4bool busy;
+
+    size_t completed;
+    double seconds;
+};
+
+#endif // G4VOXELWORKERTHREAD_H
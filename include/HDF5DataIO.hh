@@ -0,0 +1,243 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef HDF5DATAIO_H
+#define HDF5DATAIO_H
+
+// G4VOXELDATA //
+#include "G4VoxelData.hh"
+#include "G4VoxelDataIO.hh"
+
+// STL //
+#include <vector>
+
+// HDF5 //
+#include "H5Cpp.h"
+
+// GEANT4 //
+#include "globals.hh"
+
+
+// Reads a single dataset from an HDF5 file into memory, in whole or in
+// chunks via hyperslab selection. For random access to data that stays on
+// disk see `HDF5MappedIO`. Like `HDF5MappedIO` the first dataset axis is
+// taken as x, with the last axis varying fastest.
+class HDF5DataIO : public G4VoxelDataIO {
+  public:
+    HDF5DataIO() {
+        this->dataset_name = "data";
+    };
+
+    void SetDatasetName(G4String dataset_name) {
+        this->dataset_name = dataset_name;
+    };
+
+    G4String GetDatasetName() {
+        return this->dataset_name;
+    };
+
+    void SetArrayName(G4String name) {
+        SetDatasetName(name);
+    };
+
+    G4VoxelData* Read(G4String filename) {
+        if (!ReadHeader(filename)) {
+            return NULL;
+        }
+
+        std::vector<unsigned int> offset(header->ndims, 0);
+        G4VoxelData* data = ReadChunk(offset, header->shape);
+
+        ReportStats();
+
+        return data;
+    };
+
+    G4VoxelData* ReadHeader(G4String filename) {
+        logger->message << "Opening " << filename << ":" << dataset_name << std::endl;
+        G4VoxelDataIOStats::Timer open_timer(&stats, "open");
+        stats.AddFilesScanned(1);
+
+        try {
+            file = H5::H5File(filename.c_str(), H5F_ACC_RDONLY);
+            dataset = file.openDataSet(dataset_name.c_str());
+        } catch (H5::Exception&) {
+            logger->error << "Cannot open dataset " << dataset_name << " in "
+                          << filename << std::endl;
+            return NULL;
+        }
+
+        dataspace = dataset.getSpace();
+        rank = dataspace.getSimpleExtentNdims();
+
+        std::vector<hsize_t> dims(rank);
+        dataspace.getSimpleExtentDims(&dims[0]);
+
+        std::vector<unsigned int> shape(dims.begin(), dims.end());
+        while (shape.size() < 3) {
+            logger->warning << "Adding extra dimension to " << rank << "D dataset." << std::endl;
+            shape.push_back(1);
+        }
+        unsigned int ndims = shape.size();
+
+        unsigned int length = 1;
+        for (unsigned int i=0; i<ndims; i++) length *= shape[i];
+
+        std::vector<double> spacing(ndims, 1);
+        std::vector<double> origin(ndims, 0);
+
+        word_size = dataset.getDataType().getSize();
+
+        header = new G4VoxelData(NULL, length, ndims, shape, spacing, origin,
+                                 GetType(dataset), COLUMN_MAJOR);
+        return header;
+    };
+
+    G4VoxelData* ReadChunk(std::vector<unsigned int> offset,
+                           std::vector<unsigned int> shape) {
+        std::vector<hsize_t> start(offset.begin(), offset.begin() + rank);
+        std::vector<hsize_t> count(shape.begin(), shape.begin() + rank);
+
+        size_t length = 1;
+        for (unsigned int i=0; i<shape.size(); i++) length *= shape[i];
+
+        // Window into the file, and a matching contiguous block in memory.
+        dataspace.selectHyperslab(H5S_SELECT_SET, &count[0], &start[0]);
+        H5::DataSpace memspace(rank, &count[0]);
+
+        G4VoxelDataIOStats::Timer read_timer(&stats, "read");
+        std::vector<char>* buffer = new std::vector<char>(length*word_size);
+        dataset.read(&buffer->front(), dataset.getDataType(), memspace, dataspace);
+        read_timer.Stop(buffer->size());
+        stats.AddBytesRead(buffer->size());
+        stats.AddBytesDecoded(buffer->size());
+
+        return MakeChunk(buffer, offset, shape);
+    };
+
+    static G4int Sniff(G4String filename) {
+        try {
+            if (H5::H5File::isHdf5(filename.c_str())) return SNIFF_CONTENT;
+        } catch (H5::Exception&) {
+        }
+        return SNIFF_NONE;
+    };
+
+    static G4bool IsDirect() {
+        return true;
+    };
+
+    static DataType GetType(H5::DataSet& dataset) {
+        size_t size = dataset.getDataType().getSize();
+
+        if (dataset.getTypeClass() == H5T_FLOAT) {
+            if (size == 4) return FLOAT32;
+            if (size == 8) return FLOAT64;
+        } else if (dataset.getTypeClass() == H5T_INTEGER) {
+            bool is_signed = dataset.getIntType().getSign() != H5T_SGN_NONE;
+
+            if (size == 1) return is_signed ? INT8 : UINT8;
+            if (size == 2) return is_signed ? INT16 : UINT16;
+            if (size == 4) return is_signed ? INT32 : UINT32;
+            if (size == 8) return is_signed ? INT64 : UINT64;
+        }
+        return UNKNOWN;
+    };
+
+    // Write `data` (x varying fastest) as the dataset `GetDatasetName` of a
+    // new file, transposed so that the first axis is x as `Read` expects.
+    using G4VoxelDataIO::Write;
+    template <typename T>
+    void Write(G4String filename, G4VoxelData* data) {
+        unsigned int ndims = data->ndims;
+        std::vector<unsigned int>& shape = data->shape;
+
+        // Strides of the file layout, where the last axis varies fastest
+        std::vector<size_t> strides(ndims, 1);
+        for (unsigned int i=ndims-1; i>0; i--) strides[i - 1] = strides[i] * shape[i];
+
+        const T* in = reinterpret_cast<T*>(&data->array->front());
+        std::vector<T> out((size_t) strides[0] * shape[0]);
+        std::vector<unsigned int> indices(ndims, 0);
+
+        for (size_t i=0; i<out.size(); i++) {
+            size_t index = 0;
+            for (unsigned int d=0; d<ndims; d++) index += indices[d] * strides[d];
+            out[index] = in[i];
+
+            for (unsigned int d=0; d<ndims && ++indices[d] == shape[d]; d++) {
+                indices[d] = 0;
+            }
+        }
+
+        std::vector<hsize_t> dims(shape.begin(), shape.end());
+        WriteDataSet(filename, dataset_name, &out.front(), dims, H5F_ACC_TRUNC);
+    };
+
+    // Add a 1D dataset `name` to an existing file, e.g. bin edges.
+    template <typename T>
+    void Write(G4String filename, G4String name, const std::vector<T>& values) {
+        std::vector<hsize_t> dims(1, values.size());
+        WriteDataSet(filename, name, &values.front(), dims, H5F_ACC_RDWR);
+    };
+
+    static const H5::PredType& GetPredType(double) { return H5::PredType::NATIVE_DOUBLE; };
+    static const H5::PredType& GetPredType(float) { return H5::PredType::NATIVE_FLOAT; };
+    static const H5::PredType& GetPredType(int64_t) { return H5::PredType::NATIVE_INT64; };
+    static const H5::PredType& GetPredType(int32_t) { return H5::PredType::NATIVE_INT32; };
+    static const H5::PredType& GetPredType(int16_t) { return H5::PredType::NATIVE_INT16; };
+    static const H5::PredType& GetPredType(uint8_t) { return H5::PredType::NATIVE_UINT8; };
+
+  private:
+    template <typename T>
+    void WriteDataSet(G4String filename, G4String name, const T* values,
+                      std::vector<hsize_t> dims, unsigned int flags) {
+        try {
+            H5::H5File out(filename.c_str(), flags);
+            H5::DataSpace space(dims.size(), &dims[0]);
+            H5::DataSet set = out.createDataSet(name.c_str(), GetPredType(T()), space);
+            set.write(values, GetPredType(T()));
+        } catch (H5::Exception&) {
+            logger->error << "Cannot write dataset " << name << " to "
+                          << filename << std::endl;
+        }
+    };
+
+  private:
+    G4String dataset_name;
+
+    // Dataset opened by `ReadHeader`
+    H5::H5File file;
+    H5::DataSet dataset;
+    H5::DataSpace dataspace;
+    unsigned int rank;
+    size_t word_size;
+};
+
+#endif // HDF5DATAIO_H
+
@@ -31,6 +31,11 @@
 
 // G4VOXELDATA //
 #include "G4VoxelArray.hh"
+#include "G4VoxelDataLogger.hh"
+#include "G4VoxelDataIOStats.hh"
+
+// STL //
+#include <future>
 
 // HDF5 //
 #include "H5Cpp.h"
@@ -48,10 +53,18 @@ class HDF5MappedIO : public G4VoxelArray<T> {
     using G4VoxelArray<T>::UnpackIndices;
     
    HDF5MappedIO<T>() {
+       this->logger = new G4VoxelDataLogger(ERROR);
+   };
+
+   ~HDF5MappedIO() {
+       delete logger;
    };
   
   public:
     void Read(G4String filename, G4String dataset_name) {
+        G4VoxelDataIOStats::Timer open_timer(&stats, "open");
+        stats.AddFilesScanned(1);
+
         file = H5::H5File(filename.c_str(), H5F_ACC_RDONLY);
         dataset = file.openDataSet(dataset_name.c_str());
         dataspace = dataset.getSpace();
@@ -81,6 +94,14 @@ class HDF5MappedIO : public G4VoxelArray<T> {
         Init();
     };
 
+    // Open the file and read the dataset layout on a background thread.
+    // Unless HDF5 is built thread-safe, nothing else may call into HDF5
+    // until the returned future is ready.
+    std::shared_future<void> ReadAsync(G4String filename, G4String dataset_name) {
+        return std::async(std::launch::async, &HDF5MappedIO<T>::Read, this,
+                          filename, dataset_name).share();
+    };
+
     void SetBufferShape(std::vector<unsigned int> shape) {
         this->buffer_shape.assign(shape.begin(), shape.end());
     };
@@ -114,8 +135,11 @@ class HDF5MappedIO : public G4VoxelArray<T> {
             length *= this->buffer_shape[i];
         }
 
+        G4VoxelDataIOStats::Timer read_timer(&stats, "read");
         T* data_out = new T[length];
         dataset.read(data_out, H5::PredType::NATIVE_DOUBLE, memspace, dataspace);
+        read_timer.Stop(length*sizeof(T));
+        stats.AddBytesRead(length*sizeof(T));
         
         // The value request will be in the memory window minus the offset
         // applied to the disk window.
@@ -160,6 +184,16 @@ class HDF5MappedIO : public G4VoxelArray<T> {
         return GetValue(indices);
     };
 
+    // Every `GetValue` reads a buffer from disk, so the "read" phase shows
+    // how well `SetBufferShape` matches the access pattern.
+    G4VoxelDataIOStats* GetStats() {
+        return &this->stats;
+    };
+
+    void ReportStats() {
+        this->stats.Print(this->logger->message);
+    };
+
     //virtual void Write(G4String, G4MappedVoxelArray*) {
     //    G4Exception("G4VoxelData::Write", "Writing data not implemented.",
     //            FatalException, "");
@@ -175,6 +209,10 @@ class HDF5MappedIO : public G4VoxelArray<T> {
     H5::DataSpace memspace;
 
     std::vector<hsize_t> buffer_shape;
+
+  public:
+    G4VoxelDataLogger* logger;
+    G4VoxelDataIOStats stats;
 };
 
 #endif // HDF5MAPPEDIO_H
@@ -35,6 +35,12 @@
 
 // STL //
 #include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <algorithm>
+#include <stdint.h>
 
 // CNPY //
 #include "cnpy.h"
@@ -45,39 +51,259 @@
 
 class NumpyDataIO : public G4VoxelDataIO {
   public:
+    NumpyDataIO() {
+        this->array_name = "data";
+    };
+
+    // Member of npz archives to read, without the ".npy".
+    void SetArrayName(G4String name) {
+        this->array_name = name;
+    };
+
+    G4String GetArrayName() {
+        return this->array_name;
+    };
+
+    // The data is read straight from the file into the voxel buffer, no
+    // intermediate copy is made.
     G4VoxelData* Read(G4String filename) {
+        if (!ReadHeader(filename)) {
+            return NULL;
+        }
+
+        unsigned int size = header->length * word_size;
+        std::vector<char>* buffer = new std::vector<char>(size);
 
+        G4VoxelDataIOStats::Timer read_timer(&stats, "read");
+        stream.seekg(data_offset);
+        if (size > 0) stream.read(&buffer->front(), size);
+        if (!stream) {
+            logger->error << filename << " is shorter than its header says."
+                          << std::endl;
+            delete buffer;
+            return NULL;
+        }
+        read_timer.Stop(size);
+        stats.AddBytesRead(size);
+
+        ReportStats();
+
+        return new G4VoxelData(buffer, size, header->ndims, header->shape,
+                               header->spacing, header->origin, header->type, ROW_MAJOR);
+    };
+
+    G4VoxelData* ReadHeader(G4String filename) {
+        header = NULL;
         logger->message << "Opening " << filename << std::endl;
-        cnpy::NpyArray array = cnpy::npy_load(filename.c_str());
+        G4VoxelDataIOStats::Timer header_timer(&stats, "header");
+        stats.AddFilesScanned(1);
+
+        stream.close();
+        stream.clear();
+        stream.open(filename.c_str(), std::ios_base::in | std::ios_base::binary);
 
-        unsigned int ndims = array.shape.size();
-        std::vector<unsigned int> shape = array.shape;
+        if (!stream.is_open()) {
+            logger->error << "Cannot open " << filename << std::endl;
+            return NULL;
+        }
 
-        if (ndims == 2) {
-            logger->warning << "Adding extra dimension to 2D dataset." << std::endl;
-            ndims = 3;
+        // An npz archive is a zip of .npy files, members are read in place
+        // so must be stored rather than compressed.
+        G4bool archive = HasMagic(filename, 0, "PK\x03\x04");
+        if (archive && !FindMember(array_name + ".npy")) {
+            logger->error << "Cannot find uncompressed " << array_name << " in "
+                          << filename << std::endl;
+            return NULL;
+        }
+
+        // Magic string, then major/minor version. Version 1.0 stores the
+        // header length in two bytes, later versions in four.
+        char magic[6];
+        unsigned char version[2];
+        stream.read(magic, 6);
+        stream.read((char*) version, 2);
+
+        if (std::string(magic, 6) != "\x93NUMPY") {
+            logger->error << filename << " is not a numpy file." << std::endl;
+            return NULL;
+        }
+
+        unsigned char bytes[4] = {0, 0, 0, 0};
+        stream.read((char*) bytes, version[0] == 1 ? 2 : 4);
+        unsigned int header_length = bytes[0] | (bytes[1] << 8)
+                                   | (bytes[2] << 16) | (bytes[3] << 24);
+
+        std::string dict(header_length, ' ');
+        stream.read(&dict[0], header_length);
+        data_offset = stream.tellg();
+
+        // The header is a python dict literal, e.g.
+        // {'descr': '<f8', 'fortran_order': False, 'shape': (10, 20, 30), }
+        size_t start = dict.find("'", dict.find("'descr'") + 7) + 1;
+        std::string descr = dict.substr(start, dict.find("'", start) - start);
+        word_size = std::atoi(descr.c_str() + 2);
+
+        std::vector<unsigned int> shape;
+        start = dict.find("(", dict.find("'shape'")) + 1;
+        std::istringstream dims(dict.substr(start, dict.find(")", start) - start));
+        std::string dim;
+        while (std::getline(dims, dim, ',')) {
+            if (dim.find_first_of("0123456789") != std::string::npos)
+                shape.push_back(std::atoi(dim.c_str()));
+        }
+
+        // Voxels are read x fastest. Fortran ordered arrays (as `Write`
+        // saves them) have the first axis fastest and are read as they are;
+        // C ordered arrays (numpy's default, and `WriteNpz`) have the last
+        // axis fastest, so their axes are reversed, in .npy and .npz alike.
+        if (dict.find("'fortran_order': True") == std::string::npos) {
+            std::reverse(shape.begin(), shape.end());
+        }
+
+        unsigned int ndims = shape.size();
+        while (shape.size() < 3) {
+            logger->warning << "Adding extra dimension to " << ndims << "D dataset." << std::endl;
             shape.push_back(1);
         }
+        ndims = shape.size();
 
-        unsigned int size = array.word_size;
-        for (unsigned int i=0; i<ndims; i++) size *= shape[i]; 
+        unsigned int length = 1;
+        for (unsigned int i=0; i<ndims; i++) length *= shape[i];
 
         std::vector<double> spacing(ndims);
         std::fill(spacing.begin(), spacing.end(), 1);
         std::vector<double> origin(ndims);
         std::fill(origin.begin(), origin.end(), 0);
 
-        std::vector<char>* buffer = new std::vector<char>(array.data, array.data + size);
-        
-        return new G4VoxelData(buffer, size, ndims, shape, spacing, origin, UNKNOWN, ROW_MAJOR);
+        header = new G4VoxelData(NULL, length, ndims, shape, spacing, origin,
+                                 GetType(descr[1], word_size), ROW_MAJOR);
+        return header;
+    };
+
+    G4VoxelData* ReadChunk(std::vector<unsigned int> offset,
+                           std::vector<unsigned int> shape) {
+        G4VoxelDataIOStats::Timer read_timer(&stats, "read");
+        std::vector<char>* buffer =
+            ReadRawChunk(stream, data_offset, word_size, offset, shape);
+        if (!buffer) return NULL;
+
+        read_timer.Stop(buffer->size());
+        stats.AddBytesRead(buffer->size());
+
+        return MakeChunk(buffer, offset, shape);
+    };
+
+    static G4int Sniff(G4String filename) {
+        if (HasMagic(filename, 0, "\x93NUMPY")) return SNIFF_CONTENT;
+        if (HasExtension(filename, ".npz") && HasMagic(filename, 0, "PK\x03\x04")) {
+            return SNIFF_CONTENT;
+        }
+        return SNIFF_NONE;
+    };
+
+    static G4bool IsDirect() {
+        return true;
+    };
+
+    // Map a numpy type kind ('b', 'i', 'u' or 'f') and size in bytes.
+    static DataType GetType(char kind, unsigned int size) {
+        if (kind == 'b') return BOOLEAN;
+        if (kind == 'i') {
+            if (size == 1) return INT8;
+            if (size == 2) return INT16;
+            if (size == 4) return INT32;
+            if (size == 8) return INT64;
+        }
+        if (kind == 'u') {
+            if (size == 1) return UINT8;
+            if (size == 2) return UINT16;
+            if (size == 4) return UINT32;
+            if (size == 8) return UINT64;
+        }
+        if (kind == 'f') {
+            if (size == 4) return FLOAT32;
+            if (size == 8) return FLOAT64;
+        }
+        return UNKNOWN;
     };
 
     using G4VoxelDataIO::Write;
     template <typename T>
     void Write(G4String filename, G4VoxelData* data) {
-        const unsigned int shape[] = {data->shape[0], data->shape[1], data->shape[2]};
-        cnpy::npy_save(filename, reinterpret_cast<T*>(&data->array->front()), shape, data->ndims, "w", "F");
+        const std::vector<unsigned int>& shape = data->shape;
+        cnpy::npy_save(filename, reinterpret_cast<T*>(&data->array->front()), &shape[0], data->ndims, "w", "F");
+    }
+
+    // Add `data` to the archive `filename` as the array `name`, with
+    // `mode` "w" to start a new archive or "a" to append. Arrays in npz
+    // archives are C ordered, so the axes are reversed, e.g. (z, y, x).
+    template <typename T>
+    void WriteNpz(G4String filename, G4String name, G4VoxelData* data,
+                  G4String mode="w") {
+        std::vector<unsigned int> shape(data->shape.rbegin(), data->shape.rend());
+        cnpy::npz_save(filename, name, reinterpret_cast<T*>(&data->array->front()),
+                       &shape[0], data->ndims, mode);
     }
+
+    template <typename T>
+    void WriteNpz(G4String filename, G4String name, const std::vector<T>& values,
+                  G4String mode="a") {
+        const unsigned int shape[] = {(unsigned int) values.size()};
+        cnpy::npz_save(filename, name, &values.front(), shape, 1, mode);
+    }
+
+  private:
+    // Walk the local headers of a zip archive from the start of `stream`,
+    // leaving it at the data of the stored member `name`. Sizes of zip64
+    // members (as written by numpy) are in the extra field.
+    G4bool FindMember(std::string name) {
+        stream.seekg(0);
+
+        unsigned char local[30];
+        while (stream.read((char*) local, 30) &&
+               std::string((char*) local, 4) == "PK\x03\x04") {
+            unsigned int flags = local[6] | (local[7] << 8);
+            unsigned int method = local[8] | (local[9] << 8);
+            uint64_t size = local[18] | (local[19] << 8) | (local[20] << 16)
+                          | ((uint64_t) local[21] << 24);
+            unsigned int name_length = local[26] | (local[27] << 8);
+            unsigned int extra_length = local[28] | (local[29] << 8);
+
+            std::string member(name_length, ' ');
+            std::string extra(extra_length, ' ');
+            stream.read(&member[0], name_length);
+            stream.read(&extra[0], extra_length);
+
+            for (size_t i=0; size == 0xffffffff && i + 20 <= extra.size(); ) {
+                unsigned int id = (unsigned char) extra[i] | ((unsigned char) extra[i + 1] << 8);
+                unsigned int length = (unsigned char) extra[i + 2] | ((unsigned char) extra[i + 3] << 8);
+                if (id == 1) {
+                    // Uncompressed size first, then the compressed size
+                    size = 0;
+                    for (unsigned int b=0; b<8; b++) {
+                        size |= (uint64_t) (unsigned char) extra[i + 12 + b] << (8*b);
+                    }
+                }
+                i += 4 + length;
+            }
+
+            if (member == name) return method == 0;
+
+            // Sizes follow the data when flagged, the member cannot be skipped
+            if (flags & 0x08) return false;
+            stream.seekg(size, std::ios_base::cur);
+        }
+
+        return false;
+    };
+
+  private:
+    G4String array_name;
+
+    // File opened by `ReadHeader`
+    std::ifstream stream;
+    std::streamoff data_offset;
+    unsigned int word_size;
 };
 
 #endif // NUMPYDATAIO_H
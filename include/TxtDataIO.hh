@@ -55,6 +55,157 @@ class TxtDataIO : public G4VoxelDataIO {
         std::vector<double> spacing;
         std::vector<double> origin;
 
+        G4VoxelDataIOStats::Timer header_timer(&stats, "header");
+        ParseHeader(lines, ndims, shape, origin);
+        header_timer.Stop();
+        stats.AddFilesScanned(1);
+
+        unsigned int size = 1;
+        for (unsigned int i=0; i<ndims; i++) size *= shape[i];
+
+        // Populate data vector
+        G4VoxelDataIOStats::Timer parse_timer(&stats, "parse");
+        unsigned long long text_bytes = 0;
+        double val;
+        std::vector<double>* data = new std::vector<double>;
+        while (std::getline(lines, line)) {
+            text_bytes += line.size() + 1;
+            std::istringstream l(line);
+            while (l >> val) {
+                data->push_back(val);
+            }
+        }
+        parse_timer.Stop(text_bytes);
+        stats.AddBytesRead(text_bytes);
+        stats.AddBytesDecoded(data->size()*sizeof(double));
+
+        ReportStats();
+        
+        std::vector<char>* buffer = reinterpret_cast<std::vector<char>*>(data);
+        return new G4VoxelData(buffer, size, ndims, shape, spacing, origin, UNKNOWN, ROW_MAJOR);
+    };
+
+    // Text has to be parsed in order, so the stream position is kept
+    // between chunks and consecutive slabs are read in a single pass.
+    G4VoxelData* ReadHeader(G4String filename) {
+        header = NULL;
+        stream.close();
+        stream.clear();
+        stream.open(filename, std::ios_base::in);
+
+        if (!stream.is_open()) {
+            logger->error << "Cannot open " << filename << std::endl;
+            return NULL;
+        }
+
+        unsigned int ndims;
+        std::vector<unsigned int> shape;
+        std::vector<double> spacing;
+        std::vector<double> origin;
+
+        G4VoxelDataIOStats::Timer header_timer(&stats, "header");
+        ParseHeader(stream, ndims, shape, origin);
+        header_timer.Stop();
+        stats.AddFilesScanned(1);
+
+        while (shape.size() < 3) shape.push_back(1);
+        ndims = shape.size();
+        spacing.resize(ndims, 1);
+        origin.resize(ndims, 0);
+
+        data_start = stream.tellg();
+        stream_index = 0;
+
+        stream.seekg(0, std::ios_base::end);
+        file_end = stream.tellg();
+        stream.seekg(data_start);
+
+        header = new G4VoxelData(NULL, shape[0]*shape[1]*shape[2], ndims,
+                                 shape, spacing, origin, FLOAT64, ROW_MAJOR);
+        return header;
+    };
+
+    G4VoxelData* ReadChunk(std::vector<unsigned int> offset,
+                           std::vector<unsigned int> shape) {
+        std::vector<unsigned int>& full = header->shape;
+
+        size_t first = offset[0] + (size_t) full[0]*offset[1]
+                     + (size_t) full[0]*full[1]*offset[2];
+        size_t last = (offset[0] + shape[0] - 1)
+                    + (size_t) full[0]*(offset[1] + shape[1] - 1)
+                    + (size_t) full[0]*full[1]*(offset[2] + shape[2] - 1);
+
+        // Rewind only when reading backwards.
+        if (first < stream_index) {
+            stream.clear();
+            stream.seekg(data_start);
+            stream_index = 0;
+        }
+
+        std::vector<double>* data = new std::vector<double>;
+        data->reserve((size_t) shape[0]*shape[1]*shape[2]);
+
+        G4VoxelDataIOStats::Timer parse_timer(&stats, "parse");
+        std::streampos begin = stream.tellg();
+
+        double val;
+        for (; stream_index<=last && stream >> val; stream_index++) {
+            unsigned int x = stream_index % full[0];
+            unsigned int y = (stream_index / full[0]) % full[1];
+            unsigned int z = stream_index / ((size_t) full[0]*full[1]);
+
+            if (x >= offset[0] && x < offset[0] + shape[0] &&
+                y >= offset[1] && y < offset[1] + shape[1] &&
+                z >= offset[2] && z < offset[2] + shape[2]) {
+                data->push_back(val);
+            }
+        }
+
+        std::streampos end = stream.good() ? stream.tellg() : file_end;
+        parse_timer.Stop(end - begin);
+        stats.AddBytesRead(end - begin);
+        stats.AddBytesDecoded(data->size()*sizeof(double));
+
+        // The file ended before the chunk did
+        if (data->size() != (size_t) shape[0]*shape[1]*shape[2]) {
+            logger->error << "TxtDataIO::ReadChunk: Found " << data->size()
+                          << " of " << (size_t) shape[0]*shape[1]*shape[2]
+                          << " values." << std::endl;
+            delete data;
+            return NULL;
+        }
+
+        G4VoxelDataIOStats::Timer copy_timer(&stats, "copy");
+        std::vector<char>* buffer = new std::vector<char>(
+            reinterpret_cast<char*>(&data->front()),
+            reinterpret_cast<char*>(&data->front() + data->size()));
+        delete data;
+        copy_timer.Stop(buffer->size());
+
+        return MakeChunk(buffer, offset, shape);
+    };
+
+    static G4int Sniff(G4String filename) {
+        std::ifstream lines(filename.c_str(), std::ios_base::in);
+        std::string property;
+        lines >> property;
+
+        if (property == "ndims") return SNIFF_CONTENT;
+        if (HasExtension(filename, ".txt")) return SNIFF_EXTENSION;
+        return SNIFF_NONE;
+    };
+
+    static G4bool IsDirect() {
+        return false;
+    };
+
+  private:
+    void ParseHeader(std::istream& lines, unsigned int& ndims,
+                     std::vector<unsigned int>& shape,
+                     std::vector<double>& origin) {
+        std::string line;
+        ndims = 0;
+
         // Read header metadata
         while (std::getline(lines, line)) {
             std::istringstream l(line);
@@ -81,23 +232,14 @@ class TxtDataIO : public G4VoxelDataIO {
                 break;
             }
         }
-
-        unsigned int size = 1;
-        for (unsigned int i=0; i<ndims; i++) size *= shape[i];
-
-        // Populate data vector
-        double val;
-        std::vector<double>* data = new std::vector<double>;
-        while (std::getline(lines, line)) {
-            std::istringstream l(line);
-            while (l >> val) {
-                data->push_back(val);
-            }
-        }
-        
-        std::vector<char>* buffer = reinterpret_cast<std::vector<char>*>(data);
-        return new G4VoxelData(buffer, size, ndims, shape, spacing, origin, UNKNOWN, ROW_MAJOR);
     };
+
+  private:
+    // File opened by `ReadHeader`
+    std::ifstream stream;
+    std::streampos data_start;
+    std::streampos file_end;
+    size_t stream_index;
 };
 
 #endif // TXTDATAIO_H
@@ -0,0 +1,274 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+
+// G4VOXELDATA //
+#include "G4VoxelDetector.hh"
+
+// STL //
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <random>
+
+// GEANT4 //
+#include "G4RunManager.hh"
+
+#include "gtest/gtest.h"
+
+
+// Scores the same random events into a detector of each record type.
+template <typename D>
+void ScoreEvents(D* detector, unsigned int events, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<unsigned int> voxel(0, 15);
+    std::uniform_real_distribution<double> energy(0, 1);
+
+    for (unsigned int e=0; e<events; e++) {
+        detector->Initialize(0);
+        for (unsigned int k=0; k<10; k++) {
+            unsigned int x = voxel(generator);
+            unsigned int y = voxel(generator);
+            unsigned int z = voxel(generator);
+            detector->Deposit(x, y, z, energy(generator), 1);
+        }
+        detector->EndOfEvent(0);
+    }
+}
+
+void ExpectSameValues(G4VoxelArray<double>* expected, G4VoxelArray<double>* actual) {
+    ASSERT_EQ(expected->GetShape(), actual->GetShape());
+    for (size_t i=0; i<expected->array->size(); i++) {
+        EXPECT_DOUBLE_EQ((*expected->array)[i], (*actual->array)[i]) << "voxel " << i;
+    }
+    delete expected;
+    delete actual;
+}
+
+
+// A record stride of 5 (three channels, one extra and the compensation of
+// the sum) does not divide the requested block size; blocks are rounded
+// so that no record straddles two and workers never race on one.
+TEST(G4VoxelDetector, ReduceStrideNotDividingBlockSize) {
+    std::vector<unsigned int> shape(3, 20);
+    std::vector<double> spacing(3, 1.0);
+
+    G4VoxelDetector<float> master("master", shape, spacing, LOCAL_ACCUMULATION, 1);
+    master.SetCompensation(true);
+    master.SetReduceBlockSize(4096);
+    ASSERT_EQ(5u, master.GetRecords()->GetStride());
+    EXPECT_EQ(0u, master.GetReduceBlockSize() % 5);
+
+    std::vector<G4VoxelDetector<float>*> workers;
+    for (unsigned int i=0; i<4; i++) {
+        workers.push_back(new G4VoxelDetector<float>("worker", &master, i));
+        for (unsigned int z=0; z<20; z++)
+        for (unsigned int y=0; y<20; y++)
+        for (unsigned int x=0; x<20; x++) {
+            workers[i]->Deposit(x, y, z, 0.1f*(i + 1), 1);
+            workers[i]->DepositChannel(x, y, z, 3, 1);
+        }
+    }
+
+    master.Reduce(4);
+
+    G4VoxelArray<double>* energy = master.GetEnergyValues();
+    for (size_t i=0; i<energy->array->size(); i++) {
+        EXPECT_NEAR(1.0, (*energy->array)[i], 1e-6) << "voxel " << i;
+    }
+    delete energy;
+    EXPECT_FLOAT_EQ(4, master.GetChannelHistogram(3)->GetValue(19, 19, 19));
+
+    for (unsigned int i=0; i<workers.size(); i++) delete workers[i];
+}
+
+
+TEST(G4VoxelDetector, FullCheckpointRoundTrip) {
+    std::vector<unsigned int> shape(3, 16);
+    std::vector<double> spacing(3, 1.0);
+    std::string filename = ::testing::TempDir() + "g4voxel_full.ckp";
+    std::remove(filename.c_str());
+
+    G4VoxelDetector<double> detector("detector", shape, spacing);
+    ScoreEvents(&detector, 100, 1);
+    detector.WriteCheckpoint(filename, true);
+
+    G4VoxelDetector<double> restored("restored", shape, spacing);
+    ASSERT_TRUE(restored.ReadCheckpoint(filename));
+    EXPECT_EQ(detector.GetNumberOfEvents(), restored.GetNumberOfEvents());
+    ExpectSameValues(detector.GetEnergyValues(), restored.GetEnergyValues());
+    ExpectSameValues(detector.GetEnergySqValues(), restored.GetEnergySqValues());
+    ExpectSameValues(detector.GetCountsValues(), restored.GetCountsValues());
+
+    std::remove(filename.c_str());
+}
+
+
+// Incremental checkpoints append the blocks changed since the last one, a
+// checkpoint cut short while being written is ignored on reading.
+TEST(G4VoxelDetector, IncrementalCheckpointRoundTrip) {
+    std::vector<unsigned int> shape(3, 16);
+    std::vector<double> spacing(3, 1.0);
+    std::string filename = ::testing::TempDir() + "g4voxel_incremental.ckp";
+    std::remove(filename.c_str());
+
+    G4VoxelDetector<double> detector("detector", shape, spacing);
+    ScoreEvents(&detector, 100, 1);
+    detector.WriteCheckpoint(filename);
+    G4VoxelArray<double>* first = detector.GetEnergyValues();
+    G4long first_events = detector.GetNumberOfEvents();
+
+    detector.Deposit(3, 4, 5, 2, 1);
+    detector.EndOfEvent(0);
+    detector.WriteCheckpoint(filename);
+
+    G4VoxelDetector<double> restored("restored", shape, spacing);
+    ASSERT_TRUE(restored.ReadCheckpoint(filename));
+    EXPECT_EQ(detector.GetNumberOfEvents(), restored.GetNumberOfEvents());
+    ExpectSameValues(detector.GetEnergyValues(), restored.GetEnergyValues());
+
+    // Append a third checkpoint and drop its last bytes
+    detector.Deposit(5, 4, 3, 2, 1);
+    detector.EndOfEvent(0);
+    std::ifstream before(filename.c_str(), std::ios_base::binary | std::ios_base::ate);
+    std::streamoff length = before.tellg();
+    before.close();
+    detector.WriteCheckpoint(filename);
+
+    std::ifstream in(filename.c_str(), std::ios_base::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    ASSERT_GT((std::streamoff) contents.size(), length + 8);
+    std::ofstream out(filename.c_str(), std::ios_base::binary | std::ios_base::trunc);
+    out.write(contents.data(), contents.size() - 8);
+    out.close();
+
+    G4VoxelDetector<double> truncated("truncated", shape, spacing);
+    ASSERT_TRUE(truncated.ReadCheckpoint(filename));
+    EXPECT_EQ(first_events + 1, truncated.GetNumberOfEvents());
+    G4VoxelArray<double>* energy = truncated.GetEnergyValues();
+    EXPECT_DOUBLE_EQ(first->GetValue(3, 4, 5) + 2, energy->GetValue(3, 4, 5));
+    EXPECT_DOUBLE_EQ(first->GetValue(5, 4, 3), energy->GetValue(5, 4, 3));
+    delete first;
+    delete energy;
+
+    std::remove(filename.c_str());
+}
+
+
+template <typename D>
+D* ScoreWithWorkers(Accumulation accumulation) {
+    std::vector<unsigned int> shape(3, 16);
+    std::vector<double> spacing(3, 1.0);
+
+    D* master = new D("master", shape, spacing, accumulation);
+    master->SetVariance(HISTORY_VARIANCE);
+    D first("worker", master, 0);
+    D second("worker", master, 1);
+    ScoreEvents(&first, 200, 1);
+    ScoreEvents(&second, 200, 2);
+    master->Reduce(2);
+
+    return master;
+}
+
+// Sparse records only allocate the bricks that are hit, but must score
+// exactly as the dense records do.
+TEST(G4VoxelDetector, SparseRecordsMatchDense) {
+    typedef G4VoxelDetector<double> Dense;
+    typedef G4VoxelDetector<double, G4VoxelSparseRecordArray<double> > Sparse;
+
+    Accumulation modes[] = {LOCAL_ACCUMULATION, ATOMIC_ACCUMULATION};
+    for (unsigned int m=0; m<2; m++) {
+        Dense* dense = ScoreWithWorkers<Dense>(modes[m]);
+        Sparse* sparse = ScoreWithWorkers<Sparse>(modes[m]);
+
+        EXPECT_EQ(dense->GetNumberOfEvents(), sparse->GetNumberOfEvents());
+        ExpectSameValues(dense->GetEnergyValues(), sparse->GetEnergyValues());
+        ExpectSameValues(dense->GetEnergySqValues(), sparse->GetEnergySqValues());
+        ExpectSameValues(dense->GetCountsValues(), sparse->GetCountsValues());
+        ExpectSameValues(dense->GetEnergyUncertainty(), sparse->GetEnergyUncertainty());
+
+        delete dense;
+        delete sparse;
+    }
+}
+
+
+// Counts the aborts asked of it rather than ending a run.
+class AbortCountingRunManager : public G4RunManager {
+  public:
+    AbortCountingRunManager() : stops(0) {};
+
+    void AbortRun(G4bool soft_abort) {
+        if (soft_abort) stops++;
+    };
+
+    G4int stops;
+};
+
+// Once the statistics converge the run is ended once, with a soft abort
+// of the thread's own run manager, and `Reduce` re-arms the check.
+TEST(G4VoxelDetector, ConvergenceAbortsRunOnce) {
+    AbortCountingRunManager run_manager;
+
+    std::vector<unsigned int> shape(3, 16);
+    std::vector<double> spacing(3, 1.0);
+    G4VoxelDetector<double> detector("detector", shape, spacing);
+    detector.SetVariance(HISTORY_VARIANCE);
+    detector.SetConvergence(0.01, 100);
+
+    G4long events = 0;
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<double> energy(0, 1);
+    while (run_manager.stops == 0 && events < 100000) {
+        detector.Initialize(0);
+        for (unsigned int k=0; k<5; k++) {
+            detector.Deposit(7 + k%2, 7, 7, energy(generator), 1);
+        }
+        detector.EndOfEvent(0);
+        events++;
+    }
+
+    ASSERT_EQ(1, run_manager.stops);
+    EXPECT_TRUE(detector.HasConverged());
+    EXPECT_EQ(0, events % 100);
+
+    G4VoxelConvergence convergence = detector.GetLastConvergence();
+    EXPECT_TRUE(convergence.converged);
+    EXPECT_LE(convergence.mean, 0.01);
+    EXPECT_EQ(events, convergence.events);
+
+    // Events in flight complete without asking again
+    ScoreEvents(&detector, 10, 1);
+    EXPECT_EQ(1, run_manager.stops);
+
+    detector.Reduce();
+    EXPECT_FALSE(detector.HasConverged());
+}
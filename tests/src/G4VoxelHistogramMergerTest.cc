@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+
+// G4VOXELDATA //
+#include "G4VoxelHistogramMerger.hh"
+#include "G4VoxelDataIORegistry.hh"
+#include "NumpyDataIO.hh"
+
+// STL //
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdio>
+
+#include "gtest/gtest.h"
+
+
+// A job of weight w counts as if each of its histories had weight w: sum,
+// sumsq and counts add w, w^2 and w times the job's, events unweighted.
+TEST(G4VoxelHistogramMerger, WeightedJobs) {
+    G4VoxelDataIORegistry::GetInstance()->Register<NumpyDataIO>("NUMPY");
+
+    std::vector<unsigned int> shape;
+    shape.push_back(5);
+    shape.push_back(4);
+    shape.push_back(19);
+    std::vector<double> spacing(3, 1.0);
+
+    G4double weights[] = {1, 0.5};
+    G4long events[] = {100, 300};
+    std::string jobs[2];
+    for (unsigned int j=0; j<2; j++) {
+        G4VoxelArray<double> sum(shape, spacing);
+        G4VoxelArray<double> sumsq(shape, spacing);
+        G4VoxelArray<double> counts(shape, spacing);
+        for (size_t i=0; i<sum.array->size(); i++) {
+            (*sum.array)[i] = i*(j + 1);
+            (*sumsq.array)[i] = i*i*(j + 1) + 1;
+            (*counts.array)[i] = j + 1;
+        }
+
+        std::ostringstream prefix;
+        prefix << ::testing::TempDir() << "g4voxel_job" << j;
+        jobs[j] = prefix.str();
+        ASSERT_TRUE(G4VoxelHistogramMerger::WriteJob(jobs[j], &sum, &sumsq,
+                                                     &counts, events[j]));
+    }
+
+    // Slabs that do not divide the grid, on more than one thread
+    G4VoxelHistogramMerger merger;
+    merger.AddJob(jobs[0], weights[0]);
+    merger.AddJob(jobs[1], weights[1]);
+    merger.SetThreads(3);
+    merger.SetSlabThickness(4);
+
+    std::string output = ::testing::TempDir() + "g4voxel_merged";
+    ASSERT_TRUE(merger.Merge(output));
+    EXPECT_EQ(events[0] + events[1], merger.GetNumberOfEvents());
+
+    NumpyDataIO io;
+    G4VoxelArray<double> sum(io.Read(output + "_sum.npy"));
+    G4VoxelArray<double> sumsq(io.Read(output + "_sumsq.npy"));
+    G4VoxelArray<double> counts(io.Read(output + "_counts.npy"));
+    ASSERT_EQ(shape, sum.GetShape());
+    ASSERT_EQ(shape, sumsq.GetShape());
+    ASSERT_EQ(shape, counts.GetShape());
+
+    for (size_t i=0; i<sum.array->size(); i++) {
+        G4double expected_sum = 0, expected_sumsq = 0, expected_counts = 0;
+        for (unsigned int j=0; j<2; j++) {
+            G4double w = weights[j];
+            expected_sum += w*i*(j + 1);
+            expected_sumsq += w*w*(i*i*(j + 1) + 1);
+            expected_counts += w*(j + 1);
+        }
+        EXPECT_DOUBLE_EQ(expected_sum, (*sum.array)[i]) << "voxel " << i;
+        EXPECT_DOUBLE_EQ(expected_sumsq, (*sumsq.array)[i]) << "voxel " << i;
+        EXPECT_DOUBLE_EQ(expected_counts, (*counts.array)[i]) << "voxel " << i;
+    }
+
+    const char* suffixes[] = {"_sum.npy", "_sumsq.npy", "_counts.npy", "_events.npy"};
+    for (unsigned int i=0; i<4; i++) {
+        for (unsigned int j=0; j<2; j++) std::remove((jobs[j] + suffixes[i]).c_str());
+        std::remove((output + suffixes[i]).c_str());
+    }
+    std::remove((output + "_uncertainty.npy").c_str());
+}
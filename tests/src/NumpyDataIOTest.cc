@@ -0,0 +1,161 @@
+//////////////////////////////////////////////////////////////////////////
+// G4VoxelData
+// ===========
+// A general interface for loading voxelised data as geometry in GEANT4.
+//
+// Author:  Christopher M Poole <mail@christopherpoole.net>
+// Source:  http://github.com/christopherpoole/G4VoxelData
+//
+// License & Copyright
+// ===================
+// 
+// Copyright 2013 Christopher M Poole <mail@christopherpoole.net>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//////////////////////////////////////////////////////////////////////////
+
+
+
+// G4VOXELDATA //
+#include "G4VoxelArray.hh"
+#include "NumpyDataIO.hh"
+
+// STL //
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+
+#include "gtest/gtest.h"
+
+
+// The test grid is 2x3x4 in x, y and z
+static const unsigned int NX = 2, NY = 3, NZ = 4;
+
+double NumpyTestValue(unsigned int x, unsigned int y, unsigned int z) {
+    return x + 10*y + 100*z;
+}
+
+// The grid values with x, or else z, varying fastest
+std::vector<double> NumpyTestValues(G4bool x_fastest) {
+    std::vector<double> values;
+    for (unsigned int i=0; i<NX*NY*NZ; i++) {
+        if (x_fastest) {
+            values.push_back(NumpyTestValue(i%NX, i/NX%NY, i/(NX*NY)));
+        } else {
+            values.push_back(NumpyTestValue(i/(NZ*NY), i/NZ%NY, i%NZ));
+        }
+    }
+    return values;
+}
+
+// Write a version 1.0 .npy of little endian doubles, with `shape` and
+// `fortran_order` as given in its header.
+void WriteNumpyTestFile(std::string filename, std::vector<unsigned int> shape,
+                        G4bool fortran_order, const std::vector<double>& values) {
+    std::ostringstream dict;
+    dict << "{'descr': '<f8', 'fortran_order': "
+         << (fortran_order ? "True" : "False") << ", 'shape': (";
+    for (unsigned int i=0; i<shape.size(); i++) dict << shape[i] << ", ";
+    dict << "), }";
+
+    // The data starts on a multiple of 16 bytes
+    std::string header = dict.str();
+    while ((10 + header.size() + 1) % 16 != 0) header += " ";
+    header += "\n";
+
+    std::ofstream file(filename.c_str(), std::ios_base::binary);
+    file.write("\x93NUMPY\x01\x00", 8);
+    file.put(header.size() & 0xff);
+    file.put(header.size() >> 8);
+    file << header;
+    file.write((const char*) &values.front(), values.size()*sizeof(double));
+}
+
+std::vector<unsigned int> NumpyTestShape(unsigned int a, unsigned int b, unsigned int c) {
+    std::vector<unsigned int> shape;
+    shape.push_back(a);
+    shape.push_back(b);
+    shape.push_back(c);
+    return shape;
+}
+
+// Check that `data` is the test grid, with its axes reversed if `reversed`.
+void ExpectNumpyTestGrid(G4VoxelData* data, G4bool reversed) {
+    ASSERT_TRUE(data != NULL);
+    G4VoxelArray<double> array(data);
+
+    if (reversed) {
+        ASSERT_EQ(NumpyTestShape(NZ, NY, NX), array.GetShape());
+    } else {
+        ASSERT_EQ(NumpyTestShape(NX, NY, NZ), array.GetShape());
+    }
+
+    for (unsigned int z=0; z<NZ; z++)
+    for (unsigned int y=0; y<NY; y++)
+    for (unsigned int x=0; x<NX; x++) {
+        G4double value = reversed ? array.GetValue(z, y, x) : array.GetValue(x, y, z);
+        EXPECT_EQ(NumpyTestValue(x, y, z), value) << x << " " << y << " " << z;
+    }
+}
+
+
+// Fortran ordered arrays, as `Write` saves them, have x fastest already.
+TEST(NumpyDataIO, FortranOrderKeepsAxes) {
+    std::string filename = ::testing::TempDir() + "g4voxel_fortran.npy";
+    WriteNumpyTestFile(filename, NumpyTestShape(NX, NY, NZ), true, NumpyTestValues(true));
+
+    NumpyDataIO io;
+    ExpectNumpyTestGrid(io.Read(filename), false);
+    std::remove(filename.c_str());
+}
+
+// numpy's default C order has the last axis fastest, an array indexed
+// [z][y][x] in python is read as (x, y, z).
+TEST(NumpyDataIO, COrderReversesAxes) {
+    std::string filename = ::testing::TempDir() + "g4voxel_c.npy";
+    WriteNumpyTestFile(filename, NumpyTestShape(NZ, NY, NX), false, NumpyTestValues(true));
+
+    NumpyDataIO io;
+    ExpectNumpyTestGrid(io.Read(filename), false);
+
+    // and one indexed [x][y][z] is read as (z, y, x)
+    WriteNumpyTestFile(filename, NumpyTestShape(NX, NY, NZ), false, NumpyTestValues(false));
+    ExpectNumpyTestGrid(io.Read(filename), true);
+    std::remove(filename.c_str());
+}
+
+// Arrays in npz archives follow the same rule as .npy files, so an array
+// saved by `WriteNpz` reads back with the axes it was written with.
+TEST(NumpyDataIO, NpzRoundTripKeepsAxes) {
+    std::string npy = ::testing::TempDir() + "g4voxel_member.npy";
+    std::string npz = ::testing::TempDir() + "g4voxel_archive.npz";
+    WriteNumpyTestFile(npy, NumpyTestShape(NX, NY, NZ), true, NumpyTestValues(true));
+
+    NumpyDataIO io;
+    G4VoxelData* data = io.Read(npy);
+    ASSERT_TRUE(data != NULL);
+    io.WriteNpz<double>(npz, "events", std::vector<double>(1, 10), "w");
+    io.WriteNpz<double>(npz, "dose", data, "a");
+
+    io.SetArrayName("dose");
+    ExpectNumpyTestGrid(io.Read(npz), false);
+
+    io.SetArrayName("missing");
+    EXPECT_TRUE(io.Read(npz) == NULL);
+
+    std::remove(npy.c_str());
+    std::remove(npz.c_str());
+}